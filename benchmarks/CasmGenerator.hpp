@@ -0,0 +1,558 @@
+/*  Synthetic CASM map generator
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Counts of DMSM tables, sizes are picked from seeded generator.
+// Same settings make byte identical files on every machine.
+struct CasmGeneratorSettings
+{
+	int terrainModels = 64,
+		objectModels = 256,
+		objectBuffers = 512,
+		terrainBuffers = 256,
+		cachedTextures = 16, // chunks of up to 8 textures, about half of them shared
+		uncachedTextures = 32, // shared terrain textures
+		objectTextures = 128,
+		collisions = 16,
+		skyboxes = 2,
+		terrainLODs = 8,
+		TGLDs = 16,
+		effects = 16,
+		textureSize = 256; // width and height of BC1 textures
+	uint64_t seed = 1;
+};
+
+class CasmGenerator
+{
+public:
+	CasmGenerator(const CasmGeneratorSettings &inSettings) : settings(inSettings), state(0) {}
+
+	// Writes <outPath>.casmhd and <outPath>.casmda.
+	bool Generate(const std::string &outPath);
+	// FNV-1a of last generated pair, equal values mean equal inputs.
+	uint64_t GetChecksum() const { return checksum; }
+
+private:
+	struct Blob
+	{
+		int offset,
+			size;
+	};
+
+	struct ObjectTexture
+	{
+		Blob mid,
+			near;
+	};
+
+	// Everything is big endian, as on Wii U.
+	struct Buffer
+	{
+		std::vector<char> data;
+
+		int Tell() const { return static_cast<int>(data.size()); }
+		void Align(int alignment) { data.resize((data.size() + alignment - 1) / alignment * alignment); }
+		void Int(int32_t value)
+		{
+			for (int s = 24; s >= 0; s -= 8)
+				data.push_back(static_cast<char>(value >> s));
+		}
+		void Short(int16_t value)
+		{
+			data.push_back(static_cast<char>(value >> 8));
+			data.push_back(static_cast<char>(value));
+		}
+		void Float(float value)
+		{
+			int32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			Int(bits);
+		}
+		void Append(const std::vector<char> &other) { data.insert(data.end(), other.begin(), other.end()); }
+		void PutInt(int offset, int32_t value)
+		{
+			for (int s = 0; s < 4; s++)
+				data[offset + s] = static_cast<char>(value >> (24 - s * 8));
+		}
+	};
+
+	CasmGeneratorSettings settings;
+	uint64_t state,
+		checksum = 0;
+	Buffer casmda;
+
+	// xorshift64*, unlike std distributions it gives the same sequence with every standard library
+	uint64_t Next()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1Dull;
+	}
+	int Range(int minValue, int maxValue) { return minValue + static_cast<int>(Next() % (maxValue - minValue + 1)); }
+	void Random(Buffer &buffer, int size);
+
+	Blob Put(const Buffer &blob, int alignment = 16);
+	Blob PutRandom(int minSize, int maxSize);
+	Buffer MakeTexture();
+	Buffer MakeCachedChunk(int numUncached);
+	Buffer MakeObjectModel();
+	Buffer MakeTerrainModel();
+	static bool WriteFile(const std::string &path, const Buffer &buffer);
+};
+
+inline void CasmGenerator::Random(Buffer &buffer, int size)
+{
+	const size_t begin = buffer.data.size();
+	buffer.data.resize(begin + size);
+
+	// little endian, so the bytes don't depend on host
+	for (int b = 0; b < size; b += 8)
+	{
+		const uint64_t value = Next();
+		const int numBytes = std::min(8, size - b);
+
+		for (int s = 0; s < numBytes; s++)
+			buffer.data[begin + b + s] = static_cast<char>(value >> (s * 8));
+	}
+}
+
+inline CasmGenerator::Blob CasmGenerator::Put(const Buffer &blob, int alignment)
+{
+	casmda.Align(alignment);
+	const Blob result = { casmda.Tell(), blob.Tell() };
+	casmda.Append(blob.data);
+
+	return result;
+}
+
+inline CasmGenerator::Blob CasmGenerator::PutRandom(int minSize, int maxSize)
+{
+	Buffer blob;
+	Random(blob, Range(minSize, maxSize));
+
+	return Put(blob);
+}
+
+// BC1 2D surface followed by GX2 surface footer and MTXT magic.
+inline CasmGenerator::Buffer CasmGenerator::MakeTexture()
+{
+	const int width = settings.textureSize,
+		height = settings.textureSize,
+		dataSize = width * height / 2;
+
+	Buffer texture;
+	Random(texture, dataSize);
+
+	texture.Int(1); // surface dim 2D
+	texture.Int(width);
+	texture.Int(height);
+	texture.Int(1); // depth
+	texture.Int(1); // mips
+	texture.Int(0x31); // BC1
+	texture.Int(dataSize);
+	texture.Int(0); // aa mode
+	texture.Int(4); // tile mode 2D thin
+	texture.Int(0); // swizzle
+	texture.Int(0x1000); // alignment
+	texture.Int(width / 4); // pitch
+	texture.Int(10001); // version
+	texture.data.insert(texture.data.end(), { 'M', 'T', 'X', 'T' });
+
+	return texture;
+}
+
+// Terrain textures chunk, header of 254 entries followed by its own textures, others reference shared textures.
+inline CasmGenerator::Buffer CasmGenerator::MakeCachedChunk(int numUncached)
+{
+	static const int headerSize = 32 + 254 * 16;
+	const int numTextures = Range(2, 8);
+	Buffer chunk,
+		body;
+
+	chunk.Int(numTextures);
+
+	for (int u = 0; u < 7; u++)
+		chunk.Int(0);
+
+	for (int e = 0; e < numTextures; e++)
+	{
+		if (numUncached && Next() % 2)
+		{
+			chunk.Int(0);
+			chunk.Int(0);
+			chunk.Int(Range(0, numUncached - 1));
+		}
+		else
+		{
+			const Buffer texture = MakeTexture();
+			chunk.Int(texture.Tell());
+			chunk.Int(headerSize + body.Tell());
+			chunk.Int(-1);
+			body.Append(texture.data);
+		}
+
+		chunk.Int(0);
+	}
+
+	chunk.data.resize(headerSize);
+	chunk.Append(body.data);
+
+	return chunk;
+}
+
+// MapObjectModelHeader, model data, buffer indices, texture container lookups and external textures.
+inline CasmGenerator::Buffer CasmGenerator::MakeObjectModel()
+{
+	static const int headerSize = 104;
+	const int numBuffers = Range(1, 5),
+		numTextures = std::min(Range(0, 3), settings.objectTextures);
+	Buffer model;
+
+	model.data.resize(headerSize);
+	Random(model, Range(256, 8192));
+
+	const int indicesOffset = model.Tell();
+
+	for (int b = 0; b < numBuffers; b++)
+		model.Int(Range(0, settings.objectBuffers - 1));
+
+	const int lookupsOffset = model.Tell();
+
+	for (int l = 0; l < 4; l++)
+		model.Short(static_cast<int16_t>(Range(0, 3)));
+
+	const int texturesOffset = model.Tell();
+
+	for (int t = 0; t < numTextures; t++)
+	{
+		model.Short(static_cast<int16_t>(t));
+		model.Short(static_cast<int16_t>(Range(0, 3)));
+		model.Short(static_cast<int16_t>(Range(0, settings.objectTextures - 1)));
+		model.Short(0);
+	}
+
+	Random(model, Range(0, 128));
+
+	Buffer header;
+	header.Short(1);
+	header.Short(2);
+
+	const int32_t fields[] = { 0, 0, 40, 50, 0, 60, 0, texturesOffset, numTextures, indicesOffset, numBuffers,
+		0, 0, 0, 0, 0, 70, lookupsOffset, 4, 0, 0, 0, 0, 0, 0 };
+
+	for (int32_t f : fields)
+		header.Int(f);
+
+	memcpy(model.data.data(), header.data.data(), headerSize);
+
+	return model;
+}
+
+// MapTerrainHeader, model data, buffer lookups and texture container lookups.
+inline CasmGenerator::Buffer CasmGenerator::MakeTerrainModel()
+{
+	static const int headerSize = 88;
+	const int numLookups = Range(1, 4),
+		numTextures = Range(0, 3);
+	Buffer model;
+
+	model.data.resize(headerSize);
+	Random(model, Range(256, 8192));
+
+	// MXMDTerrainBufferLookupHeader_V1, lookups follow it
+	const int lookupsHeaderOffset = model.Tell();
+	model.Int(0);
+	model.Int(0);
+	model.Int(16);
+	model.Int(numLookups);
+
+	for (int l = 0; l < numLookups * 2; l++)
+		model.Int(Range(0, settings.terrainBuffers - 1));
+
+	const int lookupsOffset = model.Tell();
+
+	for (int l = 0; l < 4; l++)
+		model.Short(static_cast<int16_t>(Range(0, 3)));
+
+	const int texturesOffset = model.Tell();
+
+	for (int t = 0; t < numTextures; t++)
+	{
+		model.Short(static_cast<int16_t>(t));
+		model.Short(static_cast<int16_t>(Range(0, 3)));
+		model.Short(static_cast<int16_t>(t));
+		model.Short(0);
+	}
+
+	Buffer header;
+	header.Short(1);
+	header.Short(2);
+
+	const int32_t fields[] = { 0, 0, 40, 50, 30, 0, texturesOffset, numTextures, 0, 0, 70, lookupsOffset, 4, lookupsHeaderOffset,
+		0, 0, 0, 0, 0, 0, 0 };
+
+	for (int32_t f : fields)
+		header.Int(f);
+
+	memcpy(model.data.data(), header.data.data(), headerSize);
+
+	return model;
+}
+
+inline bool CasmGenerator::WriteFile(const std::string &path, const Buffer &buffer)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	const bool written = fwrite(buffer.data.data(), 1, buffer.data.size(), file) == buffer.data.size();
+
+	return !fclose(file) && written;
+}
+
+inline bool CasmGenerator::Generate(const std::string &outPath)
+{
+	// Field order of DMSM.
+	enum Field
+	{
+		magic, version,
+		terrainModelsCount = 6, terrainModelsOffset, objectModelsCount, objectModelsOffset,
+		havokColCount, havokColOffset, skyboxModelsCount, skyboxModelsOffset,
+		mapObjectBuffersCount = 20, mapObjectBuffersOffset, objectTexturesCount, objectTexturesOffset, havokNamesOffset,
+		TGLDNamesCount = 31, TGLDNamesOffset, TGLDInternalOffset, TGLDCount, TGLDOffset,
+		terrainCachedTexturesCount, terrainCachedTexturesOffset, terrainTexturesCount, terrainTexturesOffset,
+		bvsc_offset, null_offset, LCMDOffset, LCMDSize, EFBCount, EFBOffset, terrainLODsCount, terrainLODsOffset,
+		mapTerrainBuffersCount = 51, mapTerrainBuffersOffset, CEMSOffset,
+		numFields
+	};
+
+	state = settings.seed * 0x9E3779B97F4A7C15ull + 1;
+	casmda.data.clear();
+	casmda.data.resize(64);
+
+	std::vector<Blob> objectBuffers,
+		terrainBuffers,
+		uncachedTextures,
+		cachedTextures,
+		objectModels,
+		terrainModels,
+		skyboxes,
+		terrainLODs,
+		collisions,
+		TGLDs,
+		effects;
+	std::vector<ObjectTexture> objectTextures(settings.objectTextures);
+
+	for (int b = 0; b < settings.objectBuffers; b++)
+		objectBuffers.push_back(PutRandom(0x1000, 0x10000));
+
+	for (int b = 0; b < settings.terrainBuffers; b++)
+		terrainBuffers.push_back(PutRandom(0x1000, 0x10000));
+
+	for (int t = 0; t < settings.uncachedTextures; t++)
+		uncachedTextures.push_back(Put(MakeTexture()));
+
+	// every third texture has mid map only
+	for (int t = 0; t < settings.objectTextures; t++)
+	{
+		objectTextures[t].mid = Put(MakeTexture());
+		objectTextures[t].near = t % 3 ? Put(MakeTexture()) : Blob{ 0, 0 };
+	}
+
+	for (int c = 0; c < settings.cachedTextures; c++)
+		cachedTextures.push_back(Put(MakeCachedChunk(settings.uncachedTextures)));
+
+	for (int m = 0; m < settings.objectModels; m++)
+		objectModels.push_back(Put(MakeObjectModel()));
+
+	for (int m = 0; m < settings.terrainModels; m++)
+		terrainModels.push_back(Put(MakeTerrainModel()));
+
+	auto putModel = [&](int numHeaderInts)
+	{
+		Buffer model;
+
+		for (int i = 1; i <= numHeaderInts; i++)
+			model.Int(i);
+
+		Random(model, Range(0x1000, 0x10000));
+
+		return Put(model);
+	};
+
+	for (int s = 0; s < settings.skyboxes; s++)
+		skyboxes.push_back(putModel(16));
+
+	for (int l = 0; l < settings.terrainLODs; l++)
+		terrainLODs.push_back(putModel(18));
+
+	for (int c = 0; c < settings.collisions; c++)
+		collisions.push_back(PutRandom(0x400, 0x10000));
+
+	for (int t = 0; t < settings.TGLDs; t++)
+		TGLDs.push_back(PutRandom(0x100, 0x2000));
+
+	for (int e = 0; e < settings.effects; e++)
+		effects.push_back(PutRandom(0x400, 0x20000));
+
+	int32_t fields[numFields] = {};
+	Buffer casmhd;
+	casmhd.data.resize(numFields * 4);
+
+	// Records of given fields around offset and size, bounding values are all the same.
+	auto table = [&](const std::vector<Blob> &blobs, int numLeading, int numTrailing)
+	{
+		casmhd.Align(4);
+		const int offset = casmhd.Tell();
+
+		for (auto &b : blobs)
+		{
+			for (int f = 0; f < numLeading; f++)
+				casmhd.Float(1.5f);
+
+			casmhd.Int(b.offset);
+			casmhd.Int(b.size);
+
+			for (int f = 0; f < numTrailing; f++)
+				casmhd.Int(0);
+		}
+
+		return offset;
+	};
+
+	// EmbededHKX, name offset is relative to names block
+	Buffer collisionNames;
+	casmhd.Align(4);
+	fields[havokColOffset] = casmhd.Tell();
+
+	for (int c = 0; c < settings.collisions; c++)
+	{
+		const std::string name = "col" + std::to_string(c) + ".";
+
+		for (int f = 0; f < 13; f++)
+			casmhd.Float(1.5f);
+
+		casmhd.Int(collisions[c].offset);
+		casmhd.Int(collisions[c].size);
+
+		for (int i = 0; i < 3; i++)
+			casmhd.Int(0);
+
+		casmhd.Int(collisionNames.Tell());
+
+		for (int i = 0; i < 3; i++)
+			casmhd.Int(0);
+
+		collisionNames.data.insert(collisionNames.data.end(), name.c_str(), name.c_str() + name.size() + 1);
+	}
+
+	fields[havokColCount] = settings.collisions;
+	casmhd.Align(4);
+	fields[havokNamesOffset] = casmhd.Tell();
+	casmhd.Append(collisionNames.data);
+
+	fields[skyboxModelsCount] = settings.skyboxes;
+	fields[skyboxModelsOffset] = table(skyboxes, 13, 0);
+	fields[terrainLODsCount] = settings.terrainLODs;
+	fields[terrainLODsOffset] = table(terrainLODs, 10, 6);
+	fields[terrainTexturesCount] = settings.uncachedTextures;
+	fields[terrainTexturesOffset] = table(uncachedTextures, 0, 0);
+	fields[terrainCachedTexturesCount] = settings.cachedTextures;
+	fields[terrainCachedTexturesOffset] = table(cachedTextures, 0, 0);
+
+	casmhd.Align(4);
+	fields[objectTexturesCount] = settings.objectTextures;
+	fields[objectTexturesOffset] = casmhd.Tell();
+
+	for (auto &t : objectTextures)
+	{
+		casmhd.Int(t.mid.offset);
+		casmhd.Int(t.mid.size);
+		casmhd.Int(t.near.offset);
+		casmhd.Int(t.near.size);
+		casmhd.Int(0);
+	}
+
+	fields[terrainModelsCount] = settings.terrainModels;
+	fields[terrainModelsOffset] = table(terrainModels, 13, 4);
+	fields[objectModelsCount] = settings.objectModels;
+	fields[objectModelsOffset] = table(objectModels, 13, 1);
+	fields[mapObjectBuffersCount] = settings.objectBuffers;
+	fields[mapObjectBuffersOffset] = table(objectBuffers, 0, 0);
+	fields[mapTerrainBuffersCount] = settings.terrainBuffers;
+	fields[mapTerrainBuffersOffset] = table(terrainBuffers, 0, 0);
+	fields[TGLDCount] = settings.TGLDs;
+	fields[TGLDOffset] = table(TGLDs, 6, 6);
+
+	std::vector<int> TGLDNames;
+
+	for (int t = 0; t < settings.TGLDs; t++)
+	{
+		const std::string name = "tgld_" + std::to_string(t);
+		TGLDNames.push_back(casmhd.Tell());
+		casmhd.data.insert(casmhd.data.end(), name.c_str(), name.c_str() + name.size() + 1);
+	}
+
+	casmhd.Align(4);
+	fields[TGLDNamesCount] = settings.TGLDs;
+	fields[TGLDNamesOffset] = casmhd.Tell();
+
+	for (int n : TGLDNames)
+		casmhd.Int(n);
+
+	fields[EFBCount] = settings.effects;
+	fields[EFBOffset] = table(effects, 0, 0);
+
+	// LCMD, main TGLD, CEMS and bvsc in this order, sizes of latter are given by offset of next one
+	auto putRandom = [&](int size)
+	{
+		casmhd.Align(4);
+		const int offset = casmhd.Tell();
+		Random(casmhd, size);
+
+		return offset;
+	};
+
+	fields[LCMDSize] = Range(0x100, 0x1000);
+	fields[LCMDOffset] = putRandom(fields[LCMDSize]);
+	fields[TGLDInternalOffset] = putRandom(Range(0x100, 0x1000));
+	fields[CEMSOffset] = putRandom(Range(0x100, 0x1000));
+	fields[bvsc_offset] = putRandom(16);
+	fields[version] = 10001;
+
+	for (int f = 0; f < numFields; f++)
+		casmhd.PutInt(f * 4, fields[f]);
+
+	memcpy(casmhd.data.data(), "MSMD", 4);
+
+	checksum = 0xCBF29CE484222325ull;
+
+	for (const Buffer *b : { &casmhd, &casmda })
+		for (char c : b->data)
+			checksum = (checksum ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+
+	return WriteFile(outPath + ".casmhd", casmhd) && WriteFile(outPath + ".casmda", casmda);
+}
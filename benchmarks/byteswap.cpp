@@ -0,0 +1,87 @@
+/*  Byte swap microbenchmark
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../common/ByteSwap.hpp"
+
+typedef void (*SwapFunc)(void *, size_t, ByteSwapISA);
+
+static double Measure(SwapFunc func, std::vector<char> &buffer, size_t itemSize, ByteSwapISA isa, int numRuns)
+{
+	double best = 1e30;
+
+	for (int r = 0; r < numRuns; r++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func(buffer.data(), buffer.size() / itemSize, isa);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (elapsed.count() < best)
+			best = elapsed.count();
+	}
+
+	return best;
+}
+
+static void RunWidth(const char *name, SwapFunc func, size_t itemSize, const std::vector<char> &source, int numRuns)
+{
+	const ByteSwapISA bestISA = GetByteSwapISA();
+
+	for (int i = 0; i <= static_cast<int>(bestISA); i++)
+	{
+		const ByteSwapISA isa = static_cast<ByteSwapISA>(i);
+		std::vector<char> buffer = source;
+
+		// odd count and offset, so tails and unaligned accesses are verified too
+		func(buffer.data() + itemSize, buffer.size() / itemSize - 3, isa);
+
+		std::vector<char> expected = source;
+		func(expected.data() + itemSize, expected.size() / itemSize - 3, ByteSwapISA::Scalar);
+
+		if (memcmp(buffer.data(), expected.data(), buffer.size()))
+		{
+			printf("%s %s: MISMATCH\n", name, GetByteSwapISAName(isa));
+			exit(1);
+		}
+
+		buffer = source;
+		const double seconds = Measure(func, buffer, itemSize, isa, numRuns);
+		printf("%s %-6s %8.2f GB/s\n", name, GetByteSwapISAName(isa), buffer.size() / seconds / 1e9);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t bufferSize = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 64) * 0x100000 + 6;
+	const int numRuns = argc > 2 ? atoi(argv[2]) : 10;
+
+	std::vector<char> source(bufferSize);
+
+	for (size_t b = 0; b < bufferSize; b++)
+		source[b] = static_cast<char>(b * 131 + (b >> 8));
+
+	printf("Buffer: %zu bytes, runs: %i, detected: %s\n", bufferSize, numRuns, GetByteSwapISAName(GetByteSwapISA()));
+
+	RunWidth("16bit", SwapBytes16, 2, source, numRuns);
+	RunWidth("32bit", SwapBytes32, 4, source, numRuns);
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*  casmExtract benchmark
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "CasmGenerator.hpp"
+
+#ifdef _MSC_VER
+#include <direct.h>
+#define MakeFolder(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define MakeFolder(path) mkdir(path, 0755)
+#endif
+
+static const char help[] = "Usage: casmBenchmark [options] <casmExtract executable> [casmExtract options]\n\
+Generates synthetic maps and extracts each of them several times with -s statistics enabled.\n\
+Median wall and CPU time of every stage and of the whole run are reported.\n\
+Stage wall time is elapsed time of the stage summed over its calls, rows ending with /task\n\
+sum durations of its pool tasks across threads, so they can exceed wall time of the run.\n\
+Maps are generated from fixed seed, so every machine extracts the same data.\n\n\
+Options:\n\
+-n <runs>	Measured runs per map, 5 by default. One more warm-up run is done before them.\n\
+-p <preset>	Extracts only given map: small, medium or large. All of them by default.\n\
+-f <folder>	Folder for generated maps and outputs, casmBenchmark by default.\n\
+-r <seed>	Random seed of generated maps, 1 by default.\n\
+Options after casmExtract executable are passed to it.\n";
+
+struct Preset
+{
+	const char *name;
+	CasmGeneratorSettings settings;
+};
+
+static std::vector<Preset> GetPresets()
+{
+	Preset small = { "small", {} };
+	small.settings.terrainModels = 16;
+	small.settings.objectModels = 64;
+	small.settings.objectBuffers = 128;
+	small.settings.terrainBuffers = 64;
+	small.settings.cachedTextures = 4;
+	small.settings.uncachedTextures = 8;
+	small.settings.objectTextures = 32;
+	small.settings.collisions = 4;
+	small.settings.terrainLODs = 2;
+	small.settings.TGLDs = 4;
+	small.settings.effects = 4;
+
+	Preset medium = { "medium", {} };
+
+	Preset large = { "large", {} };
+	large.settings.terrainModels = 256;
+	large.settings.objectModels = 1024;
+	large.settings.objectBuffers = 2048;
+	large.settings.terrainBuffers = 1024;
+	large.settings.cachedTextures = 64;
+	large.settings.uncachedTextures = 128;
+	large.settings.objectTextures = 512;
+	large.settings.collisions = 64;
+	large.settings.terrainLODs = 32;
+	large.settings.TGLDs = 64;
+	large.settings.effects = 64;
+	large.settings.textureSize = 512;
+
+	return { small, medium, large };
+}
+
+struct StageTimes
+{
+	std::vector<double> wallTimes,
+		cpuTimes;
+	unsigned long long calls = 0,
+		filesCreated = 0;
+};
+
+// Reads wall time, CPU time, calls and files of every stage from -s json.
+// casmExtract writes every counter on its own line, so no json library is needed.
+static bool ReadStats(const std::string &fileName, std::map<std::string, StageTimes> &stages)
+{
+	std::ifstream ifs(fileName);
+
+	if (ifs.fail())
+		return false;
+
+	std::string line,
+		current;
+
+	while (std::getline(ifs, line))
+	{
+		const size_t nameBegin = line.find('"');
+
+		if (nameBegin == std::string::npos)
+			continue;
+
+		const size_t nameEnd = line.find('"', nameBegin + 1);
+		const std::string name = line.substr(nameBegin + 1, nameEnd - nameBegin - 1);
+		const double value = atof(line.c_str() + line.find(':') + 1);
+
+		if (line.back() == '{')
+		{
+			if (name != "stages")
+				current = name == "total" ? "Total" : name;
+		}
+		else if (current.empty())
+			continue;
+		else if (name == "wallTime")
+			stages[current].wallTimes.push_back(value);
+		else if (name == "cpuTime")
+			stages[current].cpuTimes.push_back(value);
+		else if (name == "calls")
+			stages[current].calls = static_cast<unsigned long long>(value);
+		else if (name == "filesCreated")
+			stages[current].filesCreated = static_cast<unsigned long long>(value);
+	}
+
+	return true;
+}
+
+static double Median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0.0;
+
+	std::sort(values.begin(), values.end());
+	const size_t half = values.size() / 2;
+
+	return values.size() % 2 ? values[half] : (values[half - 1] + values[half]) * 0.5;
+}
+
+static std::string Quote(const std::string &path) { return '"' + path + '"'; }
+
+static bool RunPreset(const Preset &preset, const std::string &folder, const std::string &executable, const std::string &extraArgs, int numRuns)
+{
+	const std::string mapPath = folder + preset.name,
+		statsPath = mapPath + "_stats.json",
+		logPath = mapPath + ".log";
+	CasmGenerator generator(preset.settings);
+
+	if (!generator.Generate(mapPath))
+	{
+		printf("Couldn't write %s\n", mapPath.c_str());
+		return false;
+	}
+
+	std::string command = Quote(executable) + " -s " + Quote(statsPath) + extraArgs + ' ' + Quote(mapPath + ".casmhd") + " > " + Quote(logPath) + " 2>&1";
+
+#ifdef _WIN32
+	// cmd strips outer quotes of whole command
+	command = Quote(command);
+#endif
+
+	std::map<std::string, StageTimes> stages;
+	std::vector<double> runTimes;
+
+	for (int r = -1; r < numRuns; r++)
+	{
+		remove(statsPath.c_str());
+
+		const auto start = std::chrono::steady_clock::now();
+		const int result = std::system(command.c_str());
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (result)
+		{
+			printf("%s: casmExtract failed, see %s\n", preset.name, logPath.c_str());
+			return false;
+		}
+
+		// warm-up run, fills file cache
+		if (r < 0)
+			continue;
+
+		runTimes.push_back(elapsed.count());
+
+		if (!ReadStats(statsPath, stages))
+		{
+			printf("%s: Couldn't read %s\n", preset.name, statsPath.c_str());
+			return false;
+		}
+	}
+
+	printf("\nMap: %s, input: %016llX, runs: %i\n", preset.name, static_cast<unsigned long long>(generator.GetChecksum()), numRuns);
+	printf("%-32s %8s %10s %10s %8s\n", "Stage", "Calls", "Wall[s]", "CPU[s]", "Files");
+
+	for (auto &s : stages)
+	{
+		if (s.first == "Total")
+			continue;
+
+		printf("%-32s %8llu %10.3f %10.3f %8llu\n", s.first.c_str(), s.second.calls, Median(s.second.wallTimes), Median(s.second.cpuTimes), s.second.filesCreated);
+	}
+
+	const StageTimes &total = stages["Total"];
+	printf("%-32s %8llu %10.3f %10.3f %8llu\n", "Total", total.calls, Median(total.wallTimes), Median(total.cpuTimes), total.filesCreated);
+	printf("%-32s %8s %10.3f (min %.3f, max %.3f)\n", "Process", "", Median(runTimes), *std::min_element(runTimes.begin(), runTimes.end()),
+		*std::max_element(runTimes.begin(), runTimes.end()));
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int numRuns = 5;
+	uint64_t seed = 1;
+	std::string folder = "casmBenchmark",
+		executable,
+		extraArgs;
+	const char *onlyPreset = nullptr;
+
+	for (int a = 1; a < argc; a++)
+	{
+		if (!executable.empty())
+			extraArgs += ' ' + Quote(argv[a]);
+		else if (argv[a][0] != '-')
+			executable = argv[a];
+		else if (a + 1 >= argc)
+		{
+			printf("Missing value for %s\n", argv[a]);
+			return 1;
+		}
+		else if (!strcmp(argv[a], "-n"))
+			numRuns = std::max(atoi(argv[++a]), 1);
+		else if (!strcmp(argv[a], "-p"))
+			onlyPreset = argv[++a];
+		else if (!strcmp(argv[a], "-f"))
+			folder = argv[++a];
+		else if (!strcmp(argv[a], "-r"))
+			seed = strtoull(argv[++a], nullptr, 10);
+		else
+		{
+			printf("Unknown option %s\n", argv[a]);
+			return 1;
+		}
+	}
+
+	if (executable.empty())
+	{
+		printf("%s", help);
+		return 1;
+	}
+
+	MakeFolder(folder.c_str());
+	folder += '/';
+
+	bool ran = false;
+
+	for (auto &p : GetPresets())
+	{
+		if (onlyPreset && strcmp(onlyPreset, p.name))
+			continue;
+
+		p.settings.seed = seed;
+		ran = true;
+
+		if (!RunPreset(p, folder, executable, extraArgs, numRuns))
+			return 1;
+	}
+
+	if (!ran)
+	{
+		printf("Unknown preset %s\n", onlyPreset);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*  Synthetic CASM map generator
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "CasmGenerator.hpp"
+
+static const char help[] = "Usage: casmGenerate [options] <output path without extension>\n\
+Writes synthetic .casmhd and .casmda pair, same options make the same files on every machine.\n\n\
+Options:\n\
+-t <count>	Terrain models, 64 by default.\n\
+-o <count>	Object models, 256 by default.\n\
+-b <count>	Object buffers, 512 by default.\n\
+-a <count>	Terrain buffers, 256 by default.\n\
+-c <count>	Cached terrain texture chunks, 16 by default.\n\
+-u <count>	Uncached terrain textures, 32 by default.\n\
+-x <count>	Object textures, 128 by default.\n\
+-l <count>	Collisions, 16 by default.\n\
+-k <count>	Skyboxes, 2 by default.\n\
+-d <count>	Terrain LODs, 8 by default.\n\
+-g <count>	TGLD files, 16 by default.\n\
+-e <count>	Effects, 16 by default.\n\
+-s <size>	Width and height of textures, 256 by default.\n\
+-r <seed>	Random seed, 1 by default.\n";
+
+int main(int argc, char *argv[])
+{
+	CasmGeneratorSettings settings;
+	const struct
+	{
+		const char *name;
+		int *value;
+	} counts[] =
+	{
+		{ "-t", &settings.terrainModels },
+		{ "-o", &settings.objectModels },
+		{ "-b", &settings.objectBuffers },
+		{ "-a", &settings.terrainBuffers },
+		{ "-c", &settings.cachedTextures },
+		{ "-u", &settings.uncachedTextures },
+		{ "-x", &settings.objectTextures },
+		{ "-l", &settings.collisions },
+		{ "-k", &settings.skyboxes },
+		{ "-d", &settings.terrainLODs },
+		{ "-g", &settings.TGLDs },
+		{ "-e", &settings.effects },
+		{ "-s", &settings.textureSize },
+	};
+	const char *outPath = nullptr;
+
+	for (int a = 1; a < argc; a++)
+	{
+		if (argv[a][0] != '-')
+		{
+			outPath = argv[a];
+			continue;
+		}
+
+		if (a + 1 >= argc)
+		{
+			printf("Missing value for %s\n", argv[a]);
+			return 1;
+		}
+
+		if (!strcmp(argv[a], "-r"))
+		{
+			settings.seed = strtoull(argv[++a], nullptr, 10);
+			continue;
+		}
+
+		bool found = false;
+
+		for (auto &c : counts)
+			if (!strcmp(argv[a], c.name))
+			{
+				char *end;
+				const long value = strtol(argv[++a], &end, 10);
+
+				if (*end || end == argv[a] || value < 0 || value > INT_MAX)
+				{
+					printf("Invalid count for %s: %s\n", c.name, argv[a]);
+					return 1;
+				}
+
+				*c.value = static_cast<int>(value);
+				found = true;
+			}
+
+		if (!found)
+		{
+			printf("Unknown option %s\n", argv[a]);
+			return 1;
+		}
+	}
+
+	if (!outPath)
+	{
+		printf("%s", help);
+		return 1;
+	}
+
+	// buffers are referenced by models, at least one of each kind must exist
+	if (settings.objectBuffers < 1 || settings.terrainBuffers < 1 || settings.textureSize < 4 || settings.textureSize % 4)
+	{
+		printf("Buffer counts must be positive and texture size multiple of 4.\n");
+		return 1;
+	}
+
+	CasmGenerator generator(settings);
+
+	if (!generator.Generate(outPath))
+	{
+		printf("Couldn't write %s\n", outPath);
+		return 1;
+	}
+
+	printf("%s: %016llX\n", outPath, static_cast<unsigned long long>(generator.GetChecksum()));
+
+	return 0;
+}
@@ -15,34 +15,171 @@
 	along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <climits>
+#include <cstdarg>
+#include <thread>
+#include <unordered_map>
 #include "XenoLibAPI.h"
 #include "../source/MXMD_V1.h"
 #include "datas/binreader.hpp"
 #include "datas/fileinfo.hpp"
-#include "datas/MultiThread.hpp"
 #include "datas/esstring.h"
 #include "datas/masterprinter.hpp"
+#include "../common/ByteSwap.hpp"
+#include "../common/FileIO.hpp"
+#include "../common/Glob.hpp"
+#include "../common/Hash.hpp"
+#include "../common/OutputSink.hpp"
+#include "../common/OutputState.hpp"
+#include "../common/ReadPlan.hpp"
+#include "../common/Stats.hpp"
+#include "../common/TarSink.hpp"
+#include "../common/ThreadPool.hpp"
+#include "../common/WriteBehind.hpp"
 
 #if _MSC_VER
 #include <tchar.h>
 #else
 #define _tmain main
 #define _TCHAR char
+#define _tcstol strtol
 #include <sys/stat.h>
 #define _tmkdir(lVal) mkdir(lVal, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)
 #endif
 
-static const char help[] = "Usage: casmExtract [options] <casmhd file>\n\
-casmhd file can be also drag'n'dropped onto application.\n\n\
+static const char help[] = "Usage: casmExtract [options] <casmhd files or folders>\n\
+casmhd file can be also drag'n'dropped onto application.\n\
+Folders are searched for casmhd files, all maps are extracted on shared threads.\n\n\
 Options:\n\
 -u	Exported textures will be converted into PNG format, rather than DDS.\n\
 -b	Will generate blue channel for some formats used for normal maps.\n\
+-p	Map object and terrain buffers are stored only once in shared.casmt of their folder,\n\
+	models will reference them by offset into it instead of having their own .casmt.\n\
+-c <categories>	Extracts only listed comma separated categories:\n\
+	objects, terrain, objecttextures, terraintextures, textures (both texture categories),\n\
+	skybox, cems, lcmd, tgld, effects, collision, lods.\n\
+-r <category>:<first>-<last>	Extracts only items within index range of category.\n\
+	Either bound can be omitted, a single index is also accepted. Can be used multiple times.\n\
+-n <category>:<pattern>	Extracts only items whose name matches pattern with * and ? wildcards.\n\
+	Name is output file name without extension. Can be used multiple times.\n\
+	When any of -c, -r, -n is used, categories not mentioned by them are skipped.\n\
+-g <category>:<index or name>	Extracts single item, same as -r or -n with exact value.\n\
+-x	Writes index.json table of contents with .casmda offset, size and XXH64 hash\n\
+	of every selected item, instead of extracting them.\n\
+-i	Incremental extraction, outputs made from the same data and options are skipped.\n\
+	State is kept in casmExtract.state of output folder.\n\
+-o <mode>	Output mode, folder (default) writes separate files into output folder,\n\
+	pack writes them all into single <casmhd name>.casmpack next to casmhd file.\n\
+	Pack entries are aligned and indexed at the end of pack.\n\
+	tar streams output folder as tar archive into standard output, in the same order on every run.\n\
+	Messages are printed into standard error then. Incremental mode is only available with folder output.\n\
+-m <MB>	Memory for object textures read ahead of their conversion, 256 by default.\n\
+	Shared by all maps extracted at once, textures are released as soon as they're converted.\n\
+-w <threads>	Output files are written by given number of dedicated threads, extraction doesn't wait for them.\n\
+	Converted textures are staged in hidden folder within output folder then. Not used in tar mode.\n\
+-j <count>	Maximum number of maps extracted at once, 2 by default.\n\
+	Biggest maps are started first. Maps are extracted one by one in tar mode.\n\
+-s <json file>	Prints run statistics and writes them into json file. Per stage wall and CPU time,\n\
+	bytes read and written, created files, converted textures and peak memory usage.\n\
 -h	Will show this help message.\n\
 -?	Same as -h command.";
 
 static const char pressKeyCont[] = "\nPress ENTER to close.";
 
+enum ExtractCategory
+{
+	Category_Objects,
+	Category_Terrain,
+	Category_ObjectTextures,
+	Category_TerrainTextures,
+	Category_Skybox,
+	Category_CEMS,
+	Category_LCMD,
+	Category_TGLD,
+	Category_Effects,
+	Category_Collision,
+	Category_TerrainLODs,
+	Category_Count
+};
+
+static const char *const categoryNames[Category_Count] =
+{
+	"objects",
+	"terrain",
+	"objecttextures",
+	"terraintextures",
+	"skybox",
+	"cems",
+	"lcmd",
+	"tgld",
+	"effects",
+	"collision",
+	"lods",
+};
+
+struct CategoryFilter
+{
+	bool selected;
+	std::vector<std::pair<int, int>> ranges;
+	std::vector<TSTRING> patterns;
+
+	CategoryFilter() : selected(true) {}
+
+	ES_FORCEINLINE bool IsPartial() const { return !ranges.empty() || !patterns.empty(); }
+
+	// Items without index (index < 0) never pass index ranges.
+	bool Matches(int index, const TSTRING &name) const
+	{
+		if (!selected)
+			return false;
+
+		if (!ranges.empty() && std::none_of(ranges.begin(), ranges.end(), [index](const std::pair<int, int> &r) { return index >= r.first && index <= r.second; }))
+			return false;
+
+		if (!patterns.empty() && std::none_of(patterns.begin(), patterns.end(), [&name](const TSTRING &p) { return GlobMatch(p.c_str(), name.c_str()); }))
+			return false;
+
+		return true;
+	}
+
+	ES_FORCEINLINE bool Matches(int index) const { return patterns.empty() ? Matches(index, TSTRING()) : Matches(index, ToTSTRING(index)); }
+};
+
+enum OutputMode
+{
+	Output_Folder,
+	Output_Pack,
+	Output_Tar,
+};
+
+static CategoryFilter filters[Category_Count];
+static bool filtersUsed = false;
+static bool categoryMentioned[Category_Count] = {};
+
 static TextureConversionParams texParams = {};
+static bool sharedBuffers = false;
+static bool writeIndex = false;
+static TSTRING statsFile;
+static bool singleAsset = false;
+static bool incremental = false;
+static OutputMode outputMode = Output_Folder;
+static int maxMapsInFlight = 2;
+static size_t mapPrefetchBudget = 0;
+static DirectorySink directorySink;
+// Tar stream is shared by all maps of batch.
+static std::unique_ptr<TarSink> tarSink;
+// Staging of tar and pack output, their sinks copy staged files anyway.
+static TSTRING stagingFolder;
+// Memory for tar entries waiting for their turn.
+static const size_t tarBufferBudget = 0x10000000;
+static std::atomic<int> numStagedFiles(0);
+static size_t textureBudget = 0x10000000;
+static int numWriterThreads = 0;
+// Size of data handed over to writer threads, producers wait once it's full.
+static const size_t writeBehindBudget = 0x4000000;
+static std::unique_ptr<WriteBehind> writeBehind;
+static std::atomic<size_t> texturesInFlight(0);
 
 bool CreateFile(const TSTRING &fileName, std::ofstream &ofs)
 {
@@ -57,6 +194,176 @@ bool CreateFile(const TSTRING &fileName, std::ofstream &ofs)
 	return true;
 }
 
+// State of single map, maps of batch are extracted side by side.
+struct MapContext
+{
+	TSTRING filePath,
+		outFolder,
+		stagingFolder;
+	const MappedFile *dataFile;
+	OutputSink *sink;
+	OutputState state;
+	bool incremental;
+
+	MapContext() : dataFile(nullptr), sink(&directorySink), incremental(false) {}
+};
+
+bool WriteOutput(MapContext &map, const TSTRING &fileName, const std::vector<OutputPiece> &pieces)
+{
+	if (!map.sink->Write(fileName, pieces))
+	{
+		printerror("Couldn't write file: ", << fileName);
+		return false;
+	}
+
+	Stats::AddFile();
+
+	return true;
+}
+
+ES_FORCEINLINE uint32_t GetTextureParamsKey()
+{
+	return (texParams.uncompress ? 1 : 0) | (texParams.allowBC5ZChan ? 2 : 0);
+}
+
+// Incremental mode only, true if outputs were already made from the same source range and params.
+ES_FORCEINLINE bool IsUpToDate(const MapContext &map, const TSTRING &primaryOutput, int64_t offset, int64_t size, uint32_t params = 0)
+{
+	return map.incremental && map.state.IsUpToDate(primaryOutput, offset, size, params);
+}
+
+ES_FORCEINLINE void RecordOutputs(MapContext &map, const std::vector<TSTRING> &outputs, int64_t offset, int64_t size, uint32_t params = 0)
+{
+	if (map.incremental)
+		map.state.Record(outputs, offset, size, params);
+}
+
+void ExtractRange(MapContext &map, const TSTRING &fileName, int offset, int size)
+{
+	if (IsUpToDate(map, fileName, offset, size))
+		return;
+
+	if (WriteOutput(map, fileName, { OutputPiece::Range(map.dataFile, offset, size) }))
+		RecordOutputs(map, { fileName }, offset, size);
+}
+
+// Marks category (or both texture categories) as mentioned by filter options, returns false if name is unknown.
+bool MentionCategories(const TSTRING &name, std::vector<ExtractCategory> &outCategories)
+{
+	if (name == _T("textures"))
+	{
+		outCategories.push_back(Category_ObjectTextures);
+		outCategories.push_back(Category_TerrainTextures);
+	}
+	else
+	{
+		for (int c = 0; c < Category_Count; c++)
+			if (name == esStringConvert<TCHAR>(categoryNames[c]))
+				outCategories.push_back(static_cast<ExtractCategory>(c));
+
+		if (outCategories.empty())
+		{
+			printerror("Unknown category: ", << name);
+			return false;
+		}
+	}
+
+	for (auto c : outCategories)
+		categoryMentioned[c] = true;
+
+	filtersUsed = true;
+	return true;
+}
+
+bool ParseCategoriesFilter(const TSTRING &arg)
+{
+	size_t lastPos = 0;
+
+	while (lastPos <= arg.size())
+	{
+		size_t commaPos = arg.find(',', lastPos);
+
+		if (commaPos == arg.npos)
+			commaPos = arg.size();
+
+		std::vector<ExtractCategory> categories;
+
+		if (!MentionCategories(arg.substr(lastPos, commaPos - lastPos), categories))
+			return false;
+
+		lastPos = commaPos + 1;
+	}
+
+	return true;
+}
+
+// Splits <category>:<value> argument.
+bool ParseCategoryArgument(const TSTRING &arg, std::vector<ExtractCategory> &outCategories, TSTRING &outValue)
+{
+	const size_t colonPos = arg.find(':');
+
+	if (colonPos == arg.npos || colonPos + 1 == arg.size())
+	{
+		printerror("Expected <category>:<value>, got: ", << arg);
+		return false;
+	}
+
+	outValue = arg.substr(colonPos + 1);
+	return MentionCategories(arg.substr(0, colonPos), outCategories);
+}
+
+bool ParseRangeFilter(const TSTRING &arg)
+{
+	std::vector<ExtractCategory> categories;
+	TSTRING value;
+
+	if (!ParseCategoryArgument(arg, categories, value))
+		return false;
+
+	const size_t dashPos = value.find('-');
+	const TSTRING firstStr = value.substr(0, dashPos);
+	const TSTRING lastStr = dashPos == value.npos ? firstStr : value.substr(dashPos + 1);
+	TCHAR *firstEnd = nullptr;
+	TCHAR *lastEnd = nullptr;
+	const long first = firstStr.empty() ? 0 : _tcstol(firstStr.c_str(), &firstEnd, 10);
+	const long last = lastStr.empty() ? INT_MAX : _tcstol(lastStr.c_str(), &lastEnd, 10);
+
+	if ((firstEnd && *firstEnd) || (lastEnd && *lastEnd) || first < 0 || last < first || last > INT_MAX)
+	{
+		printerror("Invalid index range: ", << value);
+		return false;
+	}
+
+	for (auto c : categories)
+		filters[c].ranges.push_back({ static_cast<int>(first), static_cast<int>(last) });
+
+	return true;
+}
+
+bool ParseNameFilter(const TSTRING &arg)
+{
+	std::vector<ExtractCategory> categories;
+	TSTRING value;
+
+	if (!ParseCategoryArgument(arg, categories, value))
+		return false;
+
+	for (auto c : categories)
+		filters[c].patterns.push_back(value);
+
+	return true;
+}
+
+bool ParseGetFilter(const TSTRING &arg)
+{
+	const size_t colonPos = arg.find(':');
+	const bool isIndex = colonPos != arg.npos && colonPos + 1 < arg.size() && arg.find_first_not_of(_T("0123456789"), colonPos + 1) == arg.npos;
+
+	singleAsset = true;
+
+	return isIndex ? ParseRangeFilter(arg) : ParseNameFilter(arg);
+}
+
 struct EmbededHKX
 {
 	float ufloat[13];
@@ -202,6 +509,16 @@ struct DMSM
 	ES_FORCEINLINE char *GetMe() { return reinterpret_cast<char *>(this); }
 	ES_FORCEINLINE EmbededHKX *GetCollisions() { return reinterpret_cast<EmbededHKX *>(GetMe() + havokColOffset); }
 	ES_FORCEINLINE const char *GetCollisionName(EmbededHKX *ehkx) { return GetMe() + havokNamesOffset + ehkx->nameOffset; }
+	// Collision names already end with extension's dot.
+	ES_FORCEINLINE std::string GetCollisionStem(EmbededHKX *ehkx)
+	{
+		std::string name = GetCollisionName(ehkx);
+
+		if (!name.empty() && name.back() == '.')
+			name.pop_back();
+
+		return name;
+	}
 	ES_FORCEINLINE SkyboxModel *GetSkyboxModels() { return reinterpret_cast<SkyboxModel *>(GetMe() + skyboxModelsOffset); }
 	ES_FORCEINLINE TerrainLODModel *GetTerrainLODs() { return reinterpret_cast<TerrainLODModel *>(GetMe() + terrainLODsOffset); }
 	ES_FORCEINLINE DataFile *GetTerrainTextures() { return reinterpret_cast<DataFile *>(GetMe() + terrainTexturesOffset); }
@@ -225,79 +542,284 @@ struct DMSM
 	ES_FORCEINLINE void SwapEndian()
 	{
 		_ArraySwap<int>(*this);
-		EmbededHKX *colls = GetCollisions();
+		SwapTable32(GetCollisions(), havokColCount);
+		SwapTable32(GetSkyboxModels(), skyboxModelsCount);
+		SwapTable32(GetTerrainLODs(), terrainLODsCount);
+		SwapTable32(GetTerrainTextures(), terrainTexturesCount);
+		SwapTable32(GetTerrainCachedTextures(), terrainCachedTexturesCount);
+		SwapTable32(GetObjectTextures(), objectTexturesCount);
+		SwapTable32(GetTerrainModels(), terrainModelsCount);
+		SwapTable32(GetObjectModels(), objectModelsCount);
+		SwapTable32(GetObjectBuffers(), mapObjectBuffersCount);
+		SwapTable32(GetTerrainBuffers(), mapTerrainBuffersCount);
+		SwapTable32(GetTGLD(), TGLDCount);
+		SwapTable32(GetTGLDNameOffsets(), TGLDNamesCount);
+		SwapTable32(GetEffectFiles(), EFBCount);
+	}
+
+};
+
+struct ExternalDataItem
+{
+	char *buffer;
+	int size;
+};
+
+TSTRING GetTextureName(const TSTRING &folder, int id)
+{
+	TSTRING texName = folder;
+
+	if (id < 1000)
+		texName.push_back('0');
+	if (id < 100)
+		texName.push_back('0');
+	if (id < 10)
+		texName.push_back('0');
+
+	texName.append(ToTSTRING(id));
+
+	return texName;
+}
+
+ES_FORCEINLINE const TCHAR *GetTextureExtension()
+{
+	return texParams.uncompress ? _T(".png") : _T(".dds");
+}
 
-		for (int c = 0; c < havokColCount; c++)
-			colls[c].SwapEndian();
+// XenoLib may write other format than requested, returns extension of the file it wrote or nullptr.
+const TCHAR *FindTextureOutput(const TSTRING &name)
+{
+	const TCHAR *otherExtension = texParams.uncompress ? _T(".dds") : _T(".png");
+
+	if (IsFile(name + GetTextureExtension()))
+		return GetTextureExtension();
+
+	return IsFile(name + otherExtension) ? otherExtension : nullptr;
+}
+
+// Calls func(categoryName, index, name, offset, size) for every .casmda range of selected items.
+// Buffers used by partially selected models aren't known until models are read, so they're left out.
+template<class Func> void EnumerateAssets(DMSM *dmsm, Func func)
+{
+	auto enumTable = [&](const char *categoryName, const CategoryFilter &filter, const auto *items, int count, auto getName)
+	{
+		if (!filter.selected)
+			return;
+
+		for (int i = 0; i < count; i++)
+		{
+			if (items[i].offset < 0 || items[i].size <= 0)
+				continue;
 
-		SkyboxModel *skyModels = GetSkyboxModels();
+			const std::string name = getName(i);
+
+			if (!filter.IsPartial() || filter.Matches(i, esStringConvert<TCHAR>(name.c_str())))
+				func(categoryName, i, name, items[i].offset, items[i].size);
+		}
+	};
 
-		for (int c = 0; c < skyboxModelsCount; c++)
-			skyModels[c].SwapEndian();
+	auto indexName = [](int i) { return std::to_string(i); };
+	auto enumBuffers = [&](const char *categoryName, const CategoryFilter &filter, const DataFile *items, int count)
+	{
+		if (!filter.IsPartial())
+			enumTable(categoryName, filter, items, count, indexName);
+	};
+
+	enumTable(categoryNames[Category_Objects], filters[Category_Objects], dmsm->GetObjectModels(), dmsm->objectModelsCount, indexName);
+	enumBuffers("objectbuffers", filters[Category_Objects], dmsm->GetObjectBuffers(), dmsm->mapObjectBuffersCount);
+	enumTable(categoryNames[Category_Terrain], filters[Category_Terrain], dmsm->GetTerrainModels(), dmsm->terrainModelsCount, indexName);
+	enumBuffers("terrainbuffers", filters[Category_Terrain], dmsm->GetTerrainBuffers(), dmsm->mapTerrainBuffersCount);
+	enumTable(categoryNames[Category_TerrainTextures], filters[Category_TerrainTextures], dmsm->GetTerrainCachedTextures(), dmsm->terrainCachedTexturesCount, indexName);
+	enumBuffers("terrainsharedtextures", filters[Category_TerrainTextures], dmsm->GetTerrainTextures(), dmsm->terrainTexturesCount);
+	enumTable(categoryNames[Category_Skybox], filters[Category_Skybox], dmsm->GetSkyboxModels(), dmsm->skyboxModelsCount, [](int i) { return "Skybox" + std::to_string(i); });
+	enumTable(categoryNames[Category_TGLD], filters[Category_TGLD], dmsm->GetTGLD(), dmsm->TGLDCount, [dmsm](int i) { return std::string(dmsm->GetTGLDName(i)); });
+	enumTable(categoryNames[Category_Effects], filters[Category_Effects], dmsm->GetEffectFiles(), dmsm->EFBCount, indexName);
+	enumTable(categoryNames[Category_Collision], filters[Category_Collision], dmsm->GetCollisions(), dmsm->havokColCount, [dmsm](int i) { return dmsm->GetCollisionStem(dmsm->GetCollisions() + i); });
+	enumTable(categoryNames[Category_TerrainLODs], filters[Category_TerrainLODs], dmsm->GetTerrainLODs(), dmsm->terrainLODsCount, indexName);
+
+	// Only one of texture's maps is extracted
+	std::vector<DataFile> objTextures(dmsm->objectTexturesCount);
+	ObjectTextureFile *objTexturesSrc = dmsm->GetObjectTextures();
+
+	for (int i = 0; i < dmsm->objectTexturesCount; i++)
+	{
+		const ObjectTextureFile &cTex = objTexturesSrc[i];
+		objTextures[i] = cTex.nearMapSize ? DataFile{ cTex.nearMapOffset, cTex.nearMapSize } : DataFile{ cTex.midMapOffset, cTex.midMapSize };
+	}
 
-		TerrainLODModel *waterModels = GetTerrainLODs();
+	enumTable(categoryNames[Category_ObjectTextures], filters[Category_ObjectTextures], objTextures.data(), dmsm->objectTexturesCount, [](int i)
+	{
+		char texName[16];
+		snprintf(texName, sizeof(texName), "%04d", i);
+		return std::string(texName);
+	});
+}
 
-		for (int c = 0; c < terrainLODsCount; c++)
-			waterModels[c].SwapEndian();
+// Every .casmda range the selected stages are going to read.
+void PlanReads(DMSM *dmsm, ReadPlan &plan)
+{
+	EnumerateAssets(dmsm, [&](const char *, int, const std::string &, int offset, int size) { plan.Add(offset, size); });
+	plan.Finalize();
+}
 
-		DataFile *cData = GetTerrainTextures();
+struct IndexEntry
+{
+	const char *category;
+	int index;
+	std::string name;
+	int offset,
+		size;
+	uint64_t hash;
+};
 
-		for (int c = 0; c < terrainTexturesCount; c++)
-			cData[c].SwapEndian();
+void WriteJSONString(std::ostream &str, const std::string &value)
+{
+	str << '"';
 
-		cData = GetTerrainCachedTextures();
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+			str << '\\' << c;
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			str << escaped;
+		}
+		else
+			str << c;
+	}
 
-		for (int c = 0; c < terrainCachedTexturesCount; c++)
-			cData[c].SwapEndian();
+	str << '"';
+}
 
-		ObjectTextureFile *texs = GetObjectTextures();
+bool HashRange(const MappedFile *dataFile, int offset, int size, uint64_t &outHash)
+{
+	if (offset < 0 || size < 0 || static_cast<size_t>(offset) + size > dataFile->GetSize())
+		return false;
 
-		for (int c = 0; c < objectTexturesCount; c++)
-			texs[c].SwapEndian();
+	if (dataFile->IsMapped())
+	{
+		Stats::AddRead(size);
+		outHash = XXHash64::Hash(dataFile->GetData() + offset, size);
+		return true;
+	}
 
-		TerrainModel *mapModels01 = GetTerrainModels();
+	static thread_local std::vector<char> buffer(0x100000);
+	XXHash64 hasher;
 
-		for (int c = 0; c < terrainModelsCount; c++)
-			mapModels01[c].SwapEndian();
+	while (size)
+	{
+		const int chunk = std::min(size, static_cast<int>(buffer.size()));
 
-		ObjectModel *mapModels02 = GetObjectModels();
+		if (!dataFile->ReadAt(buffer.data(), offset, chunk))
+			return false;
 
-		for (int c = 0; c < objectModelsCount; c++)
-			mapModels02[c].SwapEndian();
+		hasher.Update(buffer.data(), chunk);
+		offset += chunk;
+		size -= chunk;
+	}
 
-		cData = GetObjectBuffers();
+	outHash = hasher.Digest();
+	return true;
+}
 
-		for (int c = 0; c < mapObjectBuffersCount; c++)
-			cData[c].SwapEndian();
+// Writes JSON table of contents for selected assets, with XXH64 hash of their .casmda data.
+void WriteIndex(DMSM *dmsm, const TSTRING &fileName, const MappedFile *dataFile)
+{
+	Stats::Scope scope("WriteIndex");
+	std::vector<IndexEntry> entries;
 
-		cData = GetTerrainBuffers();
+	EnumerateAssets(dmsm, [&](const char *category, int index, const std::string &name, int offset, int size)
+	{
+		entries.push_back({ category, index, name, offset, size, 0 });
+	});
 
-		for (int c = 0; c < mapTerrainBuffersCount; c++)
-			cData[c].SwapEndian();
+	ParallelFor(ThreadPool::Global(), static_cast<int>(entries.size()), [&](int e)
+	{
+		Stats::Scope scope("WriteIndex/task");
+		IndexEntry &entry = entries[e];
 
-		TGLDEntry *tgldEntries = GetTGLD();
+		if (!HashRange(dataFile, entry.offset, entry.size, entry.hash))
+			printerror("Couldn't read ", << entry.category << _T(" item: ") << entry.index);
+	});
 
-		for (int c = 0; c < TGLDCount; c++)
-			tgldEntries[c].SwapEndian();
+	std::ofstream ofs;
 
-		int *nameOffsets = GetTGLDNameOffsets();
+	if (!CreateFile(fileName, ofs))
+		return;
 
-		for (int c = 0; c < TGLDNamesCount; c++)
-			FByteswapper(nameOffsets[c]);
+	ofs << "{\n\t\"casmdaSize\": " << dataFile->GetSize() << ",\n\t\"hashType\": \"xxh64\",\n\t\"assets\":\n\t[";
 
-		cData = GetEffectFiles();
+	for (size_t e = 0; e < entries.size(); e++)
+	{
+		const IndexEntry &entry = entries[e];
+		char hashStr[20];
+		snprintf(hashStr, sizeof(hashStr), "%016llx", static_cast<unsigned long long>(entry.hash));
 
-		for (int c = 0; c < EFBCount; c++)
-			cData[c].SwapEndian();
+		ofs << (e ? ",\n" : "\n") << "\t\t{ \"category\": \"" << entry.category << "\", \"index\": " << entry.index << ", \"name\": ";
+		WriteJSONString(ofs, entry.name);
+		ofs << ", \"offset\": " << entry.offset << ", \"size\": " << entry.size << ", \"hash\": \"" << hashStr << "\" }";
 	}
 
-};
+	ofs << "\n\t]\n}\n";
+}
 
-struct ExternalDataItem
+// Incremental state of texture is keyed by file it was converted into.
+TSTRING GetTextureStateKey(const MapContext &map, const TSTRING &name)
 {
-	char *buffer;
-	int size;
-};
+	const TCHAR *extension = map.incremental ? FindTextureOutput(name) : nullptr;
+
+	return name + (extension ? extension : GetTextureExtension());
+}
+
+// XenoLib writes converted texture on its own, for other than direct folder output it's staged and moved into sink.
+// Returns extension of written texture or nullptr.
+const TCHAR *ConvertTexture(MapContext &map, const ExternalDataItem &item, const TSTRING &outName)
+{
+	Stats::AddTexture("MTXT", texParams.uncompress ? "png" : "dds");
+
+	if (map.sink->IsDirectory())
+	{
+		// output of previous run mustn't pass for converted texture
+		while (const TCHAR *oldExtension = FindTextureOutput(outName))
+			if (!RemoveFile(outName + oldExtension))
+				break;
+
+		ConvertMTXT(item.buffer, item.size, outName.c_str(), texParams);
+		const TCHAR *extension = FindTextureOutput(outName);
+
+		if (!extension)
+		{
+			printerror("Couldn't convert texture: ", << outName);
+			return nullptr;
+		}
+
+		Stats::AddOutputFile(outName + extension);
+		return extension;
+	}
+
+	const TSTRING stagedName = map.stagingFolder + ToTSTRING(numStagedFiles++);
+	ConvertMTXT(item.buffer, item.size, stagedName.c_str(), texParams);
+	const TCHAR *extension = FindTextureOutput(stagedName);
+
+	if (!extension)
+	{
+		printerror("Couldn't convert texture: ", << outName);
+		return nullptr;
+	}
+
+	// staged data are counted by sink when written into output
+	Stats::AddFile();
+
+	if (!map.sink->Ingest(outName + extension, stagedName + extension))
+	{
+		printerror("Couldn't write file: ", << outName + extension);
+		return nullptr;
+	}
+
+	return extension;
+}
 
 struct mtxtQueue
 {
@@ -305,25 +827,28 @@ struct mtxtQueue
 	int queueEnd;
 	std::vector<ExternalDataItem> *offsets;
 	const TCHAR *folder;
+	MapContext *map;
+	size_t firstKey;
+	std::atomic<bool> *failed;
+	const TCHAR **extensions;
 
 	typedef void return_type;
 
-	mtxtQueue() : queue(0) {}
+	mtxtQueue() : queue(0), map(nullptr), firstKey(0), failed(nullptr), extensions(nullptr) {}
 
 	return_type RetreiveItem()
 	{
-		TSTRING texName = folder;
+		Stats::Scope scope("ExtractCachedTextures/task");
+		OutputSlot slot(*map->sink, firstKey + queue);
+		const ExternalDataItem &item = offsets->at(queue);
 
-		if (queue < 1000)
-			texName.push_back('0');
-		if (queue < 100)
-			texName.push_back('0');
-		if (queue < 10)
-			texName.push_back('0');
+		if (!item.buffer)
+			return;
 
-		texName.append(ToTSTRING(queue));
+		extensions[queue] = ConvertTexture(*map, item, GetTextureName(folder, queue));
 
-		ConvertMTXT(offsets->at(queue).buffer, offsets->at(queue).size, texName.c_str(), texParams);
+		if (!extensions[queue])
+			*failed = true;
 	}
 
 	operator bool() { return queue < queueEnd; }
@@ -347,145 +872,316 @@ struct TerrainTextureHeader
 	ES_FORCEINLINE void SwapEndian() { _ArraySwap<int>(*this); }
 };
 
-void ExtractCachedTextures(DataFile *data, DataFile *uncachedData, int count, const TSTRING &outFolder, BinReader *dataFile)
+struct CachedTexturesChunk
 {
-	int totalBufferSize = 0;
+	std::vector<char> buffer;
+	std::vector<ExternalDataItem> offsets;
+	TSTRING folder;
+};
+
+// Later use of shared texture, linked to its first use, both are chunk * 256 + entry.
+struct TextureLink
+{
+	int firstUse,
+		use;
+};
+
+// Chunks are read one ahead of conversion into two alternating buffers,
+// so workers convert chunk N while chunk N + 1 is being read.
+// Shared (uncached) textures are converted only at their first use, other uses are linked to it.
+void ExtractCachedTextures(DataFile *data, DataFile *uncachedData, int count, int uncachedCount, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractCachedTextures");
+	std::vector<TerrainTextureHeader> headers(count);
+	std::vector<int> uncachedFirstUse(uncachedCount, -1);
+	std::vector<TextureLink> uncachedLinks;
+	std::vector<bool> extractChunk(count);
+	// chunks with any texture missing aren't recorded
+	std::unique_ptr<std::atomic<bool>[]> chunkFailed(new std::atomic<bool>[count]);
+	// extension of every texture of extracted chunk, nullptr until it's written
+	std::vector<std::vector<const TCHAR *>> chunkExtensions(count);
+	int64_t totalBufferSize = 0;
+
+	const CategoryFilter &filter = filters[Category_TerrainTextures];
+	const int maxTextures = sizeof(TerrainTextureHeader::entries) / sizeof(TerrainTextureHeader::entries[0]);
+
+	// Entries pointing out of shared texture table or data file are treated as unreadable, returns -1 for them.
+	auto entrySize = [&](const TerrainTextureHeader &hdr, int e)
+	{
+		const int uncachedID = hdr.entries[e].uncachedID;
+
+		if (uncachedID >= uncachedCount)
+			return -1;
 
+		const int dataSize = uncachedID < 0 ? hdr.entries[e].size : uncachedData[uncachedID].size;
+
+		return static_cast<size_t>(dataSize) > map.dataFile->GetSize() ? -1 : dataSize;
+	};
+
+	// Headers of up to date chunks are still read, shared textures might have been converted in them
 	for (int i = 0; i < count; i++)
 	{
-		TerrainTextureHeader cHdr = {};
+		TerrainTextureHeader &cHdr = headers[i];
 		DataFile &cData = data[i];
-		dataFile->Seek(cData.offset);
-		dataFile->Read(cHdr);
-		int localTotalSize = 0;
+		chunkFailed[i] = false;
+
+		if (!filter.Matches(i))
+			continue;
+
+		extractChunk[i] = !IsUpToDate(map, GetTextureStateKey(map, GetTextureName(outFolder + ToTSTRING(i) + _T("/"), 0)), cData.offset, cData.size, GetTextureParamsKey());
+
+		if (!map.dataFile->ReadAt(reinterpret_cast<char *>(&cHdr), cData.offset, sizeof(cHdr)))
+		{
+			printerror("Couldn't read terrain textures chunk: ", << i);
+			cHdr = {};
+			chunkFailed[i] = true;
+			continue;
+		}
+
+		cHdr.SwapEndian();
+		int64_t localTotalSize = 0;
+
+		if (cHdr.numTextures < 0 || cHdr.numTextures > maxTextures)
+		{
+			printerror("Invalid number of terrain textures in chunk: ", << i);
+			cHdr.numTextures = std::max(std::min(cHdr.numTextures, maxTextures), 0);
+			chunkFailed[i] = true;
+		}
 
 		for (int e = 0; e < cHdr.numTextures; e++)
 		{
-			if (cHdr.entries[e].uncachedID < 0)
-				localTotalSize += cHdr.entries[e].size;
-			else
-				localTotalSize += uncachedData[cHdr.entries[e].uncachedID].size;
+			const int uncachedID = cHdr.entries[e].uncachedID;
+			const int dataSize = entrySize(cHdr, e);
+
+			if (dataSize < 0)
+			{
+				printerror("Couldn't read terrain texture: ", << i << '/' << e);
+				chunkFailed[i] = true;
+			}
+			else if (uncachedID < 0)
+				localTotalSize += dataSize;
+			else if (uncachedFirstUse[uncachedID] < 0)
+			{
+				uncachedFirstUse[uncachedID] = i * 256 + e;
+				localTotalSize += dataSize;
+			}
+			else if (extractChunk[i])
+				uncachedLinks.push_back({ uncachedFirstUse[uncachedID], i * 256 + e });
 		}
 
 		if (localTotalSize > totalBufferSize)
 			totalBufferSize = localTotalSize;
 	}
 
-	char *dataBuffer = static_cast<char *>(malloc(totalBufferSize));
+	CachedTexturesChunk chunks[2];
+	TaskGroup chunkTasks[2] = { { ThreadPool::Global() }, { ThreadPool::Global() } };
 
 	for (int i = 0; i < count; i++)
 	{
-		TerrainTextureHeader cHdr = {};
+		if (!extractChunk[i])
+			continue;
+
+		CachedTexturesChunk &chunk = chunks[i % 2];
+		chunkTasks[i % 2].Wait();
+
+		TerrainTextureHeader &cHdr = headers[i];
 		DataFile &cData = data[i];
-		dataFile->Seek(cData.offset);
-		dataFile->Read(cHdr);
 
-		std::vector<ExternalDataItem> offsets(cHdr.numTextures);
-		char *dataIter = dataBuffer;
+		chunk.buffer.resize(static_cast<size_t>(totalBufferSize));
+		chunk.offsets.resize(cHdr.numTextures);
+		chunkExtensions[i].resize(cHdr.numTextures);
+		char *dataIter = chunk.buffer.data();
 
 		for (int e = 0; e < cHdr.numTextures; e++)
 		{
-			if (cHdr.entries[e].uncachedID < 0)
-			{
-				const int dataSize = cHdr.entries[e].size;
-				dataFile->Seek(cData.offset + cHdr.entries[e].offset);
-				dataFile->ReadBuffer(dataIter, dataSize);
-				offsets[e].buffer = dataIter;
-				offsets[e].size = dataSize;
-				dataIter += dataSize;
-			}
-			else
+			const int uncachedID = cHdr.entries[e].uncachedID;
+			const int dataSize = entrySize(cHdr, e);
+			chunk.offsets[e].buffer = nullptr;
+			chunk.offsets[e].size = 0;
+
+			// invalid entries were reported already
+			if (dataSize < 0 || (uncachedID >= 0 && uncachedFirstUse[uncachedID] != i * 256 + e))
+				continue;
+
+			const int dataOffset = uncachedID < 0 ? cData.offset + cHdr.entries[e].offset : uncachedData[uncachedID].offset;
+
+			if (!map.dataFile->ReadAt(dataIter, dataOffset, dataSize))
 			{
-				const int dataSize = uncachedData[cHdr.entries[e].uncachedID].size;
-				dataFile->Seek(uncachedData[cHdr.entries[e].uncachedID].offset);
-				dataFile->ReadBuffer(dataIter, dataSize);
-				offsets[e].buffer = dataIter;
-				offsets[e].size = dataSize;
-				dataIter += dataSize;
+				printerror("Couldn't read terrain texture: ", << i << '/' << e);
+				chunkFailed[i] = true;
+				continue;
 			}
+
+			chunk.offsets[e].buffer = dataIter;
+			chunk.offsets[e].size = dataSize;
+			dataIter += dataSize;
 		}
 
-		TSTRING outFolderTex = outFolder + ToTSTRING(i) + _T("/");
-		_tmkdir(outFolderTex.c_str());
+		chunk.folder = outFolder + ToTSTRING(i) + _T("/");
+		map.sink->CreateFolder(chunk.folder);
 
 		mtxtQueue texQue;
-		texQue.offsets = &offsets;
-		texQue.folder = outFolderTex.c_str();
+		texQue.offsets = &chunk.offsets;
+		texQue.folder = chunk.folder.c_str();
+		texQue.map = &map;
 		texQue.queueEnd = cHdr.numTextures;
+		texQue.firstKey = map.sink->Reserve(cHdr.numTextures);
+		texQue.failed = &chunkFailed[i];
+		texQue.extensions = chunkExtensions[i].data();
 
-		RunThreadedQueue(texQue);
+		SubmitQueue(chunkTasks[i % 2], texQue);
 	}
 
-	free(dataBuffer);
-}
-
-void ExtractUncachedTextures(ObjectTextureFile *data, int count, const TSTRING &outFolder, BinReader *dataFile)
-{
-	int totalBufferSize = 0;
-
-	for (int i = 0; i < count; i++)
-		totalBufferSize += data[i].nearMapSize ? data[i].nearMapSize : data[i].midMapSize;
+	chunkTasks[0].Wait();
+	chunkTasks[1].Wait();
 
-	char *dataBuffer = static_cast<char *>(malloc(totalBufferSize));
-	char *dataIter = dataBuffer;
-	std::vector<ExternalDataItem> offsets(count);
+	const size_t firstLinkKey = map.sink->Reserve(uncachedLinks.size());
 
-	for (int i = 0; i < count; i++)
+	ParallelFor(ThreadPool::Global(), static_cast<int>(uncachedLinks.size()), [&](int l)
 	{
-		ObjectTextureFile &cData = data[i];
-
-		if (data[i].nearMapSize)
+		Stats::Scope scope("ExtractCachedTextures/task");
+		OutputSlot slot(*map.sink, firstLinkKey + l);
+		const TextureLink &link = uncachedLinks[l];
+		const int firstChunk = link.firstUse / 256,
+			chunk = link.use / 256;
+		const TSTRING firstName = GetTextureName(outFolder + ToTSTRING(firstChunk) + _T("/"), link.firstUse % 256);
+		const TSTRING name = GetTextureName(outFolder + ToTSTRING(chunk) + _T("/"), link.use % 256);
+		// first use converted by previous run is found in output folder
+		const TCHAR *extension = extractChunk[firstChunk] ? chunkExtensions[firstChunk][link.firstUse % 256] : FindTextureOutput(firstName);
+
+		if (extension && map.sink->Link(firstName + extension, name + extension))
 		{
-			dataFile->Seek(cData.nearMapOffset);
-			dataFile->ReadBuffer(dataIter, cData.nearMapSize);
-			offsets[i].buffer = dataIter;
-			offsets[i].size = cData.nearMapSize;
-			dataIter += cData.nearMapSize;
+			Stats::AddFile();
+			chunkExtensions[chunk][link.use % 256] = extension;
 		}
 		else
 		{
-			dataFile->Seek(cData.midMapOffset);
-			dataFile->ReadBuffer(dataIter, cData.midMapSize);
-			offsets[i].buffer = dataIter;
-			offsets[i].size = cData.midMapSize;
-			dataIter += cData.midMapSize;
+			printerror("Couldn't create file: ", << name);
+			chunkFailed[chunk] = true;
 		}
-	}
+	});
+
+	if (!map.incremental)
+		return;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!extractChunk[i] || chunkFailed[i])
+			continue;
 
-	mtxtQueue texQue;
-	texQue.offsets = &offsets;
-	texQue.folder = outFolder.c_str();
-	texQue.queueEnd = count;
+		const TSTRING chunkFolder = outFolder + ToTSTRING(i) + _T("/");
+		std::vector<TSTRING> outputs;
 
-	RunThreadedQueue(texQue);
+		for (int e = 0; e < headers[i].numTextures; e++)
+			outputs.push_back(GetTextureName(chunkFolder, e) + chunkExtensions[i][e]);
 
-	free(dataBuffer);
+		RecordOutputs(map, outputs, data[i].offset, data[i].size, GetTextureParamsKey());
+	}
 }
 
-void ExtractCollision(DMSM *dmsm, const TSTRING &outFolder, BinReader *dataFile)
+// Texture bigger than whole budget of object texture data read ahead of conversion gets in alone.
+bool TextureMemoryFits(size_t size)
 {
-	EmbededHKX *data = dmsm->GetCollisions();
-	int biggestSize = 0;
+	const size_t inFlight = texturesInFlight;
 
-	for (int i = 0; i < dmsm->havokColCount; i++)
-		if (data[i].size > biggestSize)
-			biggestSize = data[i].size;
+	return !inFlight || inFlight + size <= textureBudget;
+}
 
-	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
-	std::ofstream ofs;
+// Takes size from budget, runs pool tasks while it doesn't fit.
+// Wait only checks budget, reservation is done here, so it's never taken more than once.
+void ReserveTextureMemory(size_t size)
+{
+	size_t inFlight = texturesInFlight;
 
-	for (int i = 0; i < dmsm->havokColCount; i++)
+	while (true)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		if (inFlight && inFlight + size > textureBudget)
+		{
+			ThreadPool::Global().HelpUntil([size]() { return TextureMemoryFits(size); });
+			inFlight = texturesInFlight;
+		}
+		else if (texturesInFlight.compare_exchange_weak(inFlight, inFlight + size))
+			return;
+	}
+}
+
+// Textures are read in file order while they fit into budget shared by all maps in flight,
+// each one is released as soon as it's converted.
+void ExtractUncachedTextures(ObjectTextureFile *data, int count, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractUncachedTextures");
+	const CategoryFilter &filter = filters[Category_ObjectTextures];
+	std::vector<int> order;
+
+	auto textureOffset = [data](int i) { return data[i].nearMapSize ? data[i].nearMapOffset : data[i].midMapOffset; };
+	auto textureSize = [data](int i) { return data[i].nearMapSize ? data[i].nearMapSize : data[i].midMapSize; };
+
+	for (int i = 0; i < count; i++)
+		if (filter.Matches(i, GetTextureName(TSTRING(), i)) &&
+			!IsUpToDate(map, GetTextureStateKey(map, GetTextureName(outFolder, i)), textureOffset(i), textureSize(i), GetTextureParamsKey()))
+			order.push_back(i);
+
+	std::sort(order.begin(), order.end(), [&](int t0, int t1) { return textureOffset(t0) < textureOffset(t1); });
+
+	const size_t firstKey = map.sink->Reserve(order.size());
+	TaskGroup group(ThreadPool::Global());
+
+	for (size_t o = 0; o < order.size(); o++)
+	{
+		const int t = order[o];
+		const size_t dataSize = textureSize(t);
+
+		ReserveTextureMemory(dataSize);
+
+		ExternalDataItem item;
+		item.buffer = static_cast<char *>(malloc(dataSize));
+		item.size = static_cast<int>(dataSize);
+
+		if (!map.dataFile->ReadAt(item.buffer, textureOffset(t), dataSize))
+		{
+			printerror("Couldn't read object texture: ", << t);
+			// reserved slot is completed empty, so ordered output doesn't wait for it
+			OutputSlot slot(*map.sink, firstKey + o);
+			free(item.buffer);
+			texturesInFlight -= dataSize;
+			ThreadPool::Global().Notify();
+			continue;
+		}
+
+		const size_t key = firstKey + o;
+		const int sourceOffset = textureOffset(t);
+
+		group.Run([&map, &outFolder, item, t, key, sourceOffset]()
+		{
+			Stats::Scope scope("ExtractUncachedTextures/task");
+			OutputSlot slot(*map.sink, key);
+			const TSTRING outName = GetTextureName(outFolder, t);
 
-		if (CreateFile(outFolder + esStringConvert<TCHAR>(dmsm->GetCollisionName(data + i)) + _T("hkx"), ofs))
-			ofs.write(dataBuffer, data[i].size);
+			if (const TCHAR *extension = ConvertTexture(map, item, outName))
+				RecordOutputs(map, { outName + extension }, sourceOffset, item.size, GetTextureParamsKey());
 
-		ofs.close();
+			free(item.buffer);
+
+			texturesInFlight -= item.size;
+			ThreadPool::Global().Notify();
+		});
 	}
 
-	free(dataBuffer);
+	group.Wait();
+}
+
+void ExtractCollision(DMSM *dmsm, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractCollision");
+	EmbededHKX *data = dmsm->GetCollisions();
+
+	for (int i = 0; i < dmsm->havokColCount; i++)
+	{
+		const TSTRING colName = esStringConvert<TCHAR>(dmsm->GetCollisionName(data + i));
+
+		if (!filters[Category_Collision].IsPartial() || filters[Category_Collision].Matches(i, esStringConvert<TCHAR>(dmsm->GetCollisionStem(data + i).c_str())))
+			ExtractRange(map, outFolder + colName + _T("hkx"), data[i].offset, data[i].size);
+	}
 }
 
 struct SkyBoxHeader
@@ -502,8 +1198,9 @@ struct SkyBoxHeader
 	ES_FORCEINLINE void SwapEndian() { _ArraySwap<int>(*this); }
 };
 
-void ExtractSkyboxes(SkyboxModel *data, int count, const TSTRING &outFolder, BinReader *dataFile)
+void ExtractSkyboxes(SkyboxModel *data, int count, const TSTRING &outFolder, MapContext &map)
 {
+	Stats::Scope scope("ExtractSkyboxes");
 	int biggestSize = 0;
 
 	for (int i = 0; i < count; i++)
@@ -511,12 +1208,21 @@ void ExtractSkyboxes(SkyboxModel *data, int count, const TSTRING &outFolder, Bin
 			biggestSize = data[i].size;
 
 	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
-	std::ofstream ofs;
 
 	for (int i = 0; i < count; i++)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		const TSTRING skyName = _T("Skybox") + ToTSTRING(i);
+
+		const TSTRING outPath = outFolder + skyName + _T(".camdo");
+
+		if (!filters[Category_Skybox].Matches(i, skyName) || IsUpToDate(map, outPath, data[i].offset, data[i].size))
+			continue;
+
+		if (!map.dataFile->ReadAt(dataBuffer, data[i].offset, data[i].size))
+		{
+			printerror("Couldn't read skybox: ", << i);
+			continue;
+		}
 
 		MXMDHeader out = {};
 		SkyBoxHeader *hdr = reinterpret_cast<SkyBoxHeader *>(dataBuffer);
@@ -533,12 +1239,8 @@ void ExtractSkyboxes(SkyboxModel *data, int count, const TSTRING &outFolder, Bin
 		out.shadersOffset = hdr->shadersOffset + 8;
 		out.SwapEndian();
 
-		if (CreateFile(outFolder + _T("Skybox") + ToTSTRING(i) + _T(".camdo"), ofs))
-		{
-			ofs.write(reinterpret_cast<char *>(&out), sizeof(MXMDHeader));
-			ofs.write(dataBuffer + sizeof(SkyBoxHeader), data[i].size - sizeof(SkyBoxHeader));
-			ofs.close();
-		}
+		if (WriteOutput(map, outPath, { OutputPiece::Memory(&out, sizeof(MXMDHeader)), OutputPiece::Memory(dataBuffer + sizeof(SkyBoxHeader), data[i].size - sizeof(SkyBoxHeader)) }))
+			RecordOutputs(map, { outPath }, data[i].offset, data[i].size);
 	}
 
 	free(dataBuffer);
@@ -561,8 +1263,9 @@ struct TerrainLODHeader
 	ES_FORCEINLINE void SwapEndian() { _ArraySwap<int>(*this); }
 };
 
-void ExtractTerrainLODs(TerrainLODModel *data, int count, const TSTRING &outFolder, BinReader *dataFile)
+void ExtractTerrainLODs(TerrainLODModel *data, int count, const TSTRING &outFolder, MapContext &map)
 {
+	Stats::Scope scope("ExtractTerrainLODs");
 	int biggestSize = 0;
 
 	for (int i = 0; i < count; i++)
@@ -570,12 +1273,19 @@ void ExtractTerrainLODs(TerrainLODModel *data, int count, const TSTRING &outFold
 			biggestSize = data[i].size;
 
 	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
-	std::ofstream ofs;
 
 	for (int i = 0; i < count; i++)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		const TSTRING outPath = outFolder + ToTSTRING(i) + _T(".camdo");
+
+		if (!filters[Category_TerrainLODs].Matches(i) || IsUpToDate(map, outPath, data[i].offset, data[i].size))
+			continue;
+
+		if (!map.dataFile->ReadAt(dataBuffer, data[i].offset, data[i].size))
+		{
+			printerror("Couldn't read terrain LOD: ", << i);
+			continue;
+		}
 
 		MXMDHeader out = {};
 		TerrainLODHeader *hdr = reinterpret_cast<TerrainLODHeader *>(dataBuffer);
@@ -590,12 +1300,8 @@ void ExtractTerrainLODs(TerrainLODModel *data, int count, const TSTRING &outFold
 		out.cachedTexturesOffset = hdr->cachedTexturesOffset;
 		out.shadersOffset = hdr->shadersOffset;
 
-		if (CreateFile(outFolder + ToTSTRING(i) + _T(".camdo"), ofs))
-		{
-			ofs.write(reinterpret_cast<char *>(&out), sizeof(MXMDHeader));
-			ofs.write(dataBuffer + sizeof(TerrainLODHeader), data[i].size - sizeof(TerrainLODHeader));
-			ofs.close();
-		}
+		if (WriteOutput(map, outPath, { OutputPiece::Memory(&out, sizeof(MXMDHeader)), OutputPiece::Memory(dataBuffer + sizeof(TerrainLODHeader), data[i].size - sizeof(TerrainLODHeader)) }))
+			RecordOutputs(map, { outPath }, data[i].offset, data[i].size);
 	}
 
 	free(dataBuffer);
@@ -634,107 +1340,267 @@ struct MapObjectExternalTexture
 	ES_FORCEINLINE void SwapEndian() { _ArraySwap<short>(*this); }
 };
 
-void ExtractMapObjects(ObjectModel *data, DataFile *buffers, int count, const TSTRING &outFolder, BinReader *dataFile)
+struct ModelScratch
 {
-	int biggestSize = 0;
+	std::vector<char> buffer;
+	std::unordered_map<int, int> bufferOffsets;
+	std::vector<OutputPiece> bufferPieces;
+};
 
-	for (int i = 0; i < count; i++)
-		if (data[i].size > biggestSize)
-			biggestSize = data[i].size;
+// Placement of unique buffers within shared buffer file.
+struct SharedBufferLayout
+{
+	std::vector<int> offsets;
+	std::vector<int> uniqueIDs;
+	std::vector<DataFile> uniqueBuffers;
+	// Only for partial model selection, unused buffers are left out of shared file.
+	std::unique_ptr<std::atomic<bool>[]> used;
 
-	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
-	std::ofstream ofsmt;
-	std::ofstream ofs;
+	int Remap(int bufferID)
+	{
+		if (used)
+			used[uniqueIDs[bufferID]] = true;
+
+		return offsets[bufferID];
+	}
+};
+
+// Assigns every unique buffer of table an offset within shared buffer file.
+// Returns false if the shared file wouldn't be addressable by model's 32bit offsets.
+bool LayoutSharedBuffers(const DataFile *buffers, int count, SharedBufferLayout &layout)
+{
+	std::unordered_map<uint64_t, int> rangeIDs;
+	std::vector<int> uniqueOffsets;
+	int64_t totalSize = 0;
+
+	rangeIDs.reserve(count);
+	layout.offsets.resize(count);
+	layout.uniqueIDs.resize(count);
 
 	for (int i = 0; i < count; i++)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		const uint64_t rangeKey = (static_cast<uint64_t>(static_cast<uint32_t>(buffers[i].offset)) << 32) | static_cast<uint32_t>(buffers[i].size);
+		auto found = rangeIDs.find(rangeKey);
 
-		MXMDHeader out = {};
-		MapObjectModelHeader *hdr = reinterpret_cast<MapObjectModelHeader *>(dataBuffer);
-		hdr->SwapEndian();
+		if (found != rangeIDs.end())
+		{
+			layout.uniqueIDs[i] = found->second;
+			layout.offsets[i] = uniqueOffsets[found->second];
+			continue;
+		}
 
-		int *indices = reinterpret_cast<int *>(dataBuffer + hdr->externalBufferIDsOffset);
-		biggestSize = 0;
+		if (totalSize + buffers[i].size > INT_MAX)
+			return false;
 
-		for (int i = 0; i < hdr->externalBufferIDsCount; i++)
-		{
-			FByteswapper(indices[i]);
+		layout.offsets[i] = static_cast<int>(totalSize);
+		layout.uniqueIDs[i] = static_cast<int>(layout.uniqueBuffers.size());
+		rangeIDs[rangeKey] = layout.uniqueIDs[i];
+		layout.uniqueBuffers.push_back(buffers[i]);
+		uniqueOffsets.push_back(layout.offsets[i]);
+		totalSize += buffers[i].size;
+	}
 
-			if (buffers[indices[i]].size > biggestSize)
-				biggestSize = buffers[indices[i]].size;
-		}
+	return true;
+}
 
-		out.magic = CompileFourCC("DMXM");
-		out.version = 10040;
-		out.modelsOffset = hdr->modelsOffset - 36;
-		out.materialsOffset = hdr->materialsOffset - 36;
-		out.shadersOffset = hdr->shadersOffset - 36;
-		out.externalBufferIDsCount = hdr->externalBufferIDsCount;
-		out.externalBufferIDsOffset = hdr->externalBufferIDsOffset - 36;
-		out.externalTexturesCount = hdr->externalTexturesCount;
-		out.externalTexturesOffset = hdr->externalTexturesOffset - 36;
-		out.instancesOffset = hdr->instancesOffset - 36;
-		out.unkOffset0 = hdr->unkOffset0 ? hdr->unkOffset0 - 36 : 0;
+bool WriteSharedBuffers(const SharedBufferLayout &layout, const TSTRING &fileName, MapContext &map)
+{
+	Stats::Scope scope("WriteSharedBuffers");
+	std::vector<OutputPiece> pieces;
+	pieces.reserve(layout.uniqueBuffers.size());
 
-		out.SwapEndian();
+	for (size_t b = 0; b < layout.uniqueBuffers.size(); b++)
+	{
+		const DataFile &cBuff = layout.uniqueBuffers[b];
+		pieces.push_back(layout.used && !layout.used[b] ? OutputPiece::Zeros(cBuff.size) : OutputPiece::Range(map.dataFile, cBuff.offset, cBuff.size));
+	}
 
-		if (!CreateFile(outFolder + ToTSTRING(i) + _T(".casmt"), ofsmt))
-			continue;
+	return WriteOutput(map, fileName, pieces);
+}
 
-		std::vector<DataFile> externalDatas;
-		char *masterBuffer = static_cast<char *>(malloc(biggestSize));
+// Runs extractModel over all selected models, with their buffers either in own .casmt files or in single shared.casmt.
+template<class T, class Func> void ExtractMapModels(const T *models, int count, DataFile *buffers, int buffersCount, const CategoryFilter &filter, const TSTRING &outFolder, MapContext &map, Func extractModel)
+{
+	SharedBufferLayout layout;
+	SharedBufferLayout *modelLayout = nullptr;
 
-		for (int i = 0; i < hdr->externalBufferIDsCount; i++)
+	if (sharedBuffers)
+	{
+		if (LayoutSharedBuffers(buffers, buffersCount, layout))
+			modelLayout = &layout;
+		else
+			printwarning("Buffers are too big for shared.casmt, using separate .casmt files in: ", << outFolder);
+	}
+
+	// With partial selection, shared file is written once models report which buffers they use.
+	// Such file has holes, so it's never considered up to date and all selected models must fill it.
+	const bool partialShared = modelLayout && filter.IsPartial();
+	const TSTRING sharedPath = outFolder + _T("shared.casmt");
+	TaskGroup group(ThreadPool::Global());
+
+	if (partialShared)
+	{
+		layout.used.reset(new std::atomic<bool>[layout.uniqueBuffers.size()]);
+
+		for (size_t b = 0; b < layout.uniqueBuffers.size(); b++)
+			layout.used[b] = false;
+
+		if (map.incremental)
+			map.state.Forget(sharedPath);
+	}
+	else if (modelLayout)
+	{
+		const size_t sharedKey = map.sink->Reserve(1);
+
+		group.Run([&, sharedKey]()
 		{
-			int &cIndex = indices[i];
-			DataFile &cBuff = buffers[cIndex];
-			bool found = false;
+			OutputSlot slot(*map.sink, sharedKey);
+			int64_t sharedOffset = INT64_MAX,
+				sharedSize = 0;
 
-			for (auto &o : externalDatas)
-				if (o.size == cIndex)
-				{
-					cIndex = o.offset;
-					FByteswapper(cIndex);
-					found = true;
-				}
+			for (auto &b : layout.uniqueBuffers)
+			{
+				sharedOffset = std::min<int64_t>(sharedOffset, b.offset);
+				sharedSize += b.size;
+			}
 
-			if (found)
-				continue;
+			// shared file is made from all unique buffers, their table is keyed by hash
+			const uint32_t sharedParams = static_cast<uint32_t>(XXHash64::Hash(layout.uniqueBuffers.data(), layout.uniqueBuffers.size() * sizeof(DataFile)));
 
-			dataFile->Seek(cBuff.offset);
-			dataFile->ReadBuffer(masterBuffer, cBuff.size);
+			if (IsUpToDate(map, sharedPath, sharedOffset, sharedSize, sharedParams))
+				return;
 
-			externalDatas.push_back({ static_cast<int>(ofsmt.tellp()), cIndex });
+			if (WriteSharedBuffers(layout, sharedPath, map))
+				RecordOutputs(map, { sharedPath }, sharedOffset, sharedSize, sharedParams);
+		});
+	}
 
-			cIndex = externalDatas.back().offset;
-			FByteswapper(cIndex);
+	// Models are queued in file order, so workers sweep .casmda along with prefetch
+	std::vector<int> order;
+	order.reserve(count);
 
-			ofsmt.write(masterBuffer, cBuff.size);
-		}
+	for (int i = 0; i < count; i++)
+		if (filter.Matches(i))
+			order.push_back(i);
 
-		free(masterBuffer);
-		ofsmt.close();
+	std::sort(order.begin(), order.end(), [models](int m0, int m1) { return models[m0].offset < models[m1].offset; });
+	const size_t firstModelKey = map.sink->Reserve(order.size());
 
-		short *containerLookups = reinterpret_cast<short *>(dataBuffer + hdr->textureContainerLookupsOffset);
-		MapObjectExternalTexture *textures = reinterpret_cast<MapObjectExternalTexture *>(dataBuffer + hdr->externalTexturesOffset);
+	ParallelFor(ThreadPool::Global(), static_cast<int>(order.size()), [&](int i)
+	{
+		OutputSlot slot(*map.sink, firstModelKey + i);
+		const int m = order[i];
+		const TSTRING modelPath = outFolder + ToTSTRING(m) + _T(".camdo");
+		const uint32_t params = modelLayout ? 1 : 0;
 
-		for (int i = 0; i < hdr->externalTexturesCount; i++)
-		{
-			FByteswapper(textures[i].containerID);
-			textures[i].containerID = containerLookups[textures[i].containerID];
-		}
+		if (!partialShared && IsUpToDate(map, modelPath, models[m].offset, models[m].size, params))
+			return;
+
+		// Shared by all models extracted on this thread. It's safe only because model bodies never wait
+		// in the pool, so no other model can be started on this thread while scratch is in use.
+		static thread_local ModelScratch scratch;
+
+		if (!extractModel(m, modelLayout, scratch))
+			return;
+
+		if (modelLayout)
+			RecordOutputs(map, { modelPath }, models[m].offset, models[m].size, params);
+		else
+			RecordOutputs(map, { modelPath, outFolder + ToTSTRING(m) + _T(".casmt") }, models[m].offset, models[m].size, params);
+	});
+
+	if (partialShared)
+		WriteSharedBuffers(layout, sharedPath, map);
+
+	group.Wait();
+}
+
+bool ExtractMapObject(ObjectModel *data, int i, DataFile *buffers, const TSTRING &outFolder, MapContext &map, SharedBufferLayout *sharedLayout, ModelScratch &scratch)
+{
+	if (scratch.buffer.size() < static_cast<size_t>(data[i].size))
+		scratch.buffer.resize(data[i].size);
+
+	char *dataBuffer = scratch.buffer.data();
 
-		if (CreateFile(outFolder + ToTSTRING(i) + _T(".camdo"), ofs))
+	if (!map.dataFile->ReadAt(dataBuffer, data[i].offset, data[i].size))
+	{
+		printerror("Couldn't read object model: ", << i);
+		return false;
+	}
+
+	MXMDHeader out = {};
+	MapObjectModelHeader *hdr = reinterpret_cast<MapObjectModelHeader *>(dataBuffer);
+	hdr->SwapEndian();
+
+	int *indices = reinterpret_cast<int *>(dataBuffer + hdr->externalBufferIDsOffset);
+	SwapTable32(indices, hdr->externalBufferIDsCount);
+
+	out.magic = CompileFourCC("DMXM");
+	out.version = 10040;
+	out.modelsOffset = hdr->modelsOffset - 36;
+	out.materialsOffset = hdr->materialsOffset - 36;
+	out.shadersOffset = hdr->shadersOffset - 36;
+	out.externalBufferIDsCount = hdr->externalBufferIDsCount;
+	out.externalBufferIDsOffset = hdr->externalBufferIDsOffset - 36;
+	out.externalTexturesCount = hdr->externalTexturesCount;
+	out.externalTexturesOffset = hdr->externalTexturesOffset - 36;
+	out.instancesOffset = hdr->instancesOffset - 36;
+	out.unkOffset0 = hdr->unkOffset0 ? hdr->unkOffset0 - 36 : 0;
+
+	out.SwapEndian();
+
+	if (sharedLayout)
+	{
+		for (int i = 0; i < hdr->externalBufferIDsCount; i++)
+			indices[i] = sharedLayout->Remap(indices[i]);
+	}
+	else
+	{
+		int bufferOffset = 0;
+		scratch.bufferOffsets.clear();
+		scratch.bufferPieces.clear();
+
+		for (int i = 0; i < hdr->externalBufferIDsCount; i++)
 		{
-			ofs.write(reinterpret_cast<char *>(&out), sizeof(MXMDHeader));
-			ofs.write(dataBuffer + sizeof(MapObjectModelHeader), data[i].size - sizeof(MapObjectModelHeader));
-			ofs.close();
+			int &cIndex = indices[i];
+			auto inserted = scratch.bufferOffsets.insert({ cIndex, bufferOffset });
+
+			if (inserted.second)
+			{
+				DataFile &cBuff = buffers[cIndex];
+				scratch.bufferPieces.push_back(OutputPiece::Range(map.dataFile, cBuff.offset, cBuff.size));
+				bufferOffset += cBuff.size;
+			}
+
+			cIndex = inserted.first->second;
 		}
+
+		if (!WriteOutput(map, outFolder + ToTSTRING(i) + _T(".casmt"), scratch.bufferPieces))
+			return false;
 	}
 
-	free(dataBuffer);
+	SwapTable32(indices, hdr->externalBufferIDsCount);
+
+	short *containerLookups = reinterpret_cast<short *>(dataBuffer + hdr->textureContainerLookupsOffset);
+	MapObjectExternalTexture *textures = reinterpret_cast<MapObjectExternalTexture *>(dataBuffer + hdr->externalTexturesOffset);
+
+	for (int i = 0; i < hdr->externalTexturesCount; i++)
+	{
+		FByteswapper(textures[i].containerID);
+		textures[i].containerID = containerLookups[textures[i].containerID];
+	}
+
+	return WriteOutput(map, outFolder + ToTSTRING(i) + _T(".camdo"), { OutputPiece::Memory(&out, sizeof(MXMDHeader)), OutputPiece::Memory(dataBuffer + sizeof(MapObjectModelHeader), data[i].size - sizeof(MapObjectModelHeader)) });
+}
+
+void ExtractMapObjects(ObjectModel *data, int count, DataFile *buffers, int buffersCount, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractMapObjects");
+	ExtractMapModels(data, count, buffers, buffersCount, filters[Category_Objects], outFolder, map, [&](int i, SharedBufferLayout *sharedLayout, ModelScratch &scratch)
+	{
+		Stats::Scope scope("ExtractMapObjects/task");
+		return ExtractMapObject(data, i, buffers, outFolder, map, sharedLayout, scratch);
+	});
 }
 
 struct MapTerrainHeader
@@ -759,175 +1625,439 @@ struct MapTerrainHeader
 	ES_FORCEINLINE void SwapEndian() { _ArraySwap<int>(*this); }
 };
 
-void ExtractMapTerrain(TerrainModel *data, DataFile *buffers, int count, const TSTRING &outFolder, BinReader *dataFile)
+bool ExtractMapTerrainModel(TerrainModel *data, int i, DataFile *buffers, const TSTRING &outFolder, MapContext &map, SharedBufferLayout *sharedLayout, ModelScratch &scratch)
 {
-	int biggestSize = 0;
-
-	for (int i = 0; i < count; i++)
-		if (data[i].size > biggestSize)
-			biggestSize = data[i].size;
+	if (scratch.buffer.size() < static_cast<size_t>(data[i].size))
+		scratch.buffer.resize(data[i].size);
 
-	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
-	std::ofstream ofsmt;
-	std::ofstream ofs;
+	char *dataBuffer = scratch.buffer.data();
 
-	for (int i = 0; i < count; i++)
+	if (!map.dataFile->ReadAt(dataBuffer, data[i].offset, data[i].size))
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
-
-		MXMDHeader out = {};
-		MapTerrainHeader *hdr = reinterpret_cast<MapTerrainHeader *>(dataBuffer);
-		hdr->SwapEndian();
-
-		MXMDTerrainBufferLookupHeader_V1 *lookups = reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(dataBuffer + hdr->externalBufferIDsOffset);
-		lookups->SwapEndian();
-		MXMDTerrainBufferLookup_V1 *bufferLookups = lookups->GetBufferLookups();
-		biggestSize = 0;
-
-		for (int i = 0; i < lookups->bufferLookupCount; i++)
-		{
-			if (buffers[bufferLookups[i].bufferIndex[0]].size > biggestSize)
-				biggestSize = buffers[bufferLookups[i].bufferIndex[0]].size;
+		printerror("Couldn't read terrain model: ", << i);
+		return false;
+	}
 
-			if (buffers[bufferLookups[i].bufferIndex[1]].size > biggestSize)
-				biggestSize = buffers[bufferLookups[i].bufferIndex[1]].size;
-		}
+	MXMDHeader out = {};
+	MapTerrainHeader *hdr = reinterpret_cast<MapTerrainHeader *>(dataBuffer);
+	hdr->SwapEndian();
 
-		out.magic = CompileFourCC("DMXM");
-		out.version = 10040;
-		out.modelsOffset = hdr->modelsOffset - 20;
-		out.materialsOffset = hdr->materialsOffset - 20;
-		out.shadersOffset = hdr->shadersOffset - 20;
-		out.externalBufferIDsOffset = hdr->externalBufferIDsOffset - 20;
-		out.externalBufferIDsCount = -1;
-		out.externalTexturesCount = hdr->externalTexturesCount;
-		out.externalTexturesOffset = hdr->externalTexturesOffset - 20;
-		out.unkOffset0 = hdr->unkOffset0 ? hdr->unkOffset0 - 20 : 0;
+	MXMDTerrainBufferLookupHeader_V1 *lookups = reinterpret_cast<MXMDTerrainBufferLookupHeader_V1 *>(dataBuffer + hdr->externalBufferIDsOffset);
+	lookups->SwapEndian();
+	MXMDTerrainBufferLookup_V1 *bufferLookups = lookups->GetBufferLookups();
 
-		out.SwapEndian();
+	out.magic = CompileFourCC("DMXM");
+	out.version = 10040;
+	out.modelsOffset = hdr->modelsOffset - 20;
+	out.materialsOffset = hdr->materialsOffset - 20;
+	out.shadersOffset = hdr->shadersOffset - 20;
+	out.externalBufferIDsOffset = hdr->externalBufferIDsOffset - 20;
+	out.externalBufferIDsCount = -1;
+	out.externalTexturesCount = hdr->externalTexturesCount;
+	out.externalTexturesOffset = hdr->externalTexturesOffset - 20;
+	out.unkOffset0 = hdr->unkOffset0 ? hdr->unkOffset0 - 20 : 0;
 
-		if (!CreateFile(outFolder + ToTSTRING(i) + _T(".casmt"), ofsmt))
-			continue;
+	out.SwapEndian();
 
-		std::vector<DataFile> externalDatas;
-		char *masterBuffer = static_cast<char *>(malloc(biggestSize));
+	if (sharedLayout)
+	{
+		for (int i = 0; i < lookups->bufferLookupCount; i++)
+			for (int s = 0; s < 2; s++)
+			{
+				int &cIndex = bufferLookups[i].bufferIndex[s];
+				cIndex = sharedLayout->Remap(cIndex);
+			}
+	}
+	else
+	{
+		int bufferOffset = 0;
+		scratch.bufferOffsets.clear();
+		scratch.bufferPieces.clear();
 
 		for (int i = 0; i < lookups->bufferLookupCount; i++)
 			for (int s = 0; s < 2; s++)
 			{
 				int &cIndex = bufferLookups[i].bufferIndex[s];
-				DataFile &cBuff = buffers[cIndex];
-				bool found = false;
+				auto inserted = scratch.bufferOffsets.insert({ cIndex, bufferOffset });
+
+				if (inserted.second)
+				{
+					DataFile &cBuff = buffers[cIndex];
+					scratch.bufferPieces.push_back(OutputPiece::Range(map.dataFile, cBuff.offset, cBuff.size));
+					bufferOffset += cBuff.size;
+				}
 
-				for (auto &o : externalDatas)
-					if (o.size == cIndex)
-					{
-						cIndex = o.offset;
-						found = true;
-					}
+				cIndex = inserted.first->second;
+			}
 
-				if (found)
-					continue;
+		if (!WriteOutput(map, outFolder + ToTSTRING(i) + _T(".casmt"), scratch.bufferPieces))
+			return false;
+	}
 
-				dataFile->Seek(cBuff.offset);
-				dataFile->ReadBuffer(masterBuffer, cBuff.size);
+	lookups->RSwapEndian();
 
-				externalDatas.push_back({ static_cast<int>(ofsmt.tellp()), cIndex });
-				cIndex = externalDatas.back().offset;
-				ofsmt.write(masterBuffer, cBuff.size);
-			}
+	short *containerLookups = reinterpret_cast<short *>(dataBuffer + hdr->textureContainerLookupsOffset);
+	MapObjectExternalTexture *textures = reinterpret_cast<MapObjectExternalTexture *>(dataBuffer + hdr->externalTexturesOffset);
+
+	for (int i = 0; i < hdr->externalTexturesCount; i++)
+	{
+		FByteswapper(textures[i].containerID);
+		textures[i].containerID = containerLookups[textures[i].containerID];
+	}
+
+	return WriteOutput(map, outFolder + ToTSTRING(i) + _T(".camdo"), { OutputPiece::Memory(&out, sizeof(MXMDHeader)), OutputPiece::Memory(dataBuffer + sizeof(MapTerrainHeader), data[i].size - sizeof(MapTerrainHeader)) });
+}
+
+void ExtractMapTerrain(TerrainModel *data, int count, DataFile *buffers, int buffersCount, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractMapTerrain");
+	ExtractMapModels(data, count, buffers, buffersCount, filters[Category_Terrain], outFolder, map, [&](int i, SharedBufferLayout *sharedLayout, ModelScratch &scratch)
+	{
+		Stats::Scope scope("ExtractMapTerrain/task");
+		return ExtractMapTerrainModel(data, i, buffers, outFolder, map, sharedLayout, scratch);
+	});
+}
+
+void ExtractTGLD(DMSM *dmsm, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractTGLD");
+	const CategoryFilter &filter = filters[Category_TGLD];
+
+	if (filter.Matches(-1, _T("main")))
+		WriteOutput(map, outFolder + _T("main.tgld"), { OutputPiece::Memory(dmsm->GetMainTGLD(), dmsm->GetMainTGLDSize()) });
+
+	TGLDEntry *data = dmsm->GetTGLD();
+
+	for (int i = 0; i < dmsm->TGLDCount; i++)
+	{
+		const TSTRING tgldName = esStringConvert<TCHAR>(dmsm->GetTGLDName(i));
+
+		if (filter.Matches(i, tgldName))
+			ExtractRange(map, outFolder + tgldName + _T(".tgld"), data[i].offset, data[i].size);
+	}
+}
+
+void ExtractEffects(DataFile *data, int count, const TSTRING &outFolder, MapContext &map)
+{
+	Stats::Scope scope("ExtractEffects");
+	for (int i = 0; i < count; i++)
+		if (filters[Category_Effects].Matches(i))
+			ExtractRange(map, outFolder + ToTSTRING(i) + _T(".epac"), data[i].offset, data[i].size);
+}
+
+int64_t GetModifiedTime(const TSTRING &filePath)
+{
+#if _MSC_VER
+	struct _stat64 fileStat;
+	return _tstat64(filePath.c_str(), &fileStat) ? 0 : fileStat.st_mtime;
+#else
+	struct stat fileStat;
+	return stat(filePath.c_str(), &fileStat) ? 0 : fileStat.st_mtime;
+#endif
+}
 
+// Returns 0 or exit code of failure.
+int ExtractMap(const TSTRING &filePath)
+{
+	Stats::Scope scope("ExtractMap");
+	BinReader rd(filePath);
+
+	if (!rd.IsValid())
+	{
+		printerror("Cannot open file: ", << filePath);
+		return 3;
+	}
+
+	TFileInfo fleInf(filePath);
+
+	const TSTRING dataFileName = fleInf.GetPath() + fleInf.GetFileName() + _T(".casmda");
+	MappedFile dataFile(dataFileName);
+
+	if (!dataFile.IsValid())
+	{
+		printerror("Cannot open file: ", << dataFileName);
+		return 4;
+	}
+
+	const size_t fleSize = rd.GetSize();
+	char *masterBuffer = static_cast<char *>(malloc(fleSize));
+	rd.ReadBuffer(masterBuffer, fleSize);
+	Stats::AddRead(fleSize);
+	DMSM *dmsm = reinterpret_cast<DMSM *>(masterBuffer);
+
+	if (dmsm->magic != DMSM::ID)
+	{
+		printerror("Invalid DMSM file: ", << filePath);
 		free(masterBuffer);
-		ofsmt.close();
-		lookups->RSwapEndian();
+		return 5;
+	}
+
+	dmsm->SwapEndian();
 
-		short *containerLookups = reinterpret_cast<short *>(dataBuffer + hdr->textureContainerLookupsOffset);
-		MapObjectExternalTexture *textures = reinterpret_cast<MapObjectExternalTexture *>(dataBuffer + hdr->externalTexturesOffset);
+	printline("Extracting CASM file: ", << filePath);
 
-		for (int i = 0; i < hdr->externalTexturesCount; i++)
+	MapContext map;
+	map.filePath = filePath;
+	map.outFolder = fleInf.GetPath() + fleInf.GetFileName() + _T("/");
+	map.dataFile = &dataFile;
+
+	const TSTRING &outFolder = map.outFolder;
+	const TSTRING packPath = fleInf.GetPath() + fleInf.GetFileName() + _T(".casmpack");
+	std::unique_ptr<PackSink> packSink;
+
+	// Index is always written as plain file into output folder
+	if (outputMode == Output_Pack && !writeIndex)
+	{
+		packSink.reset(new PackSink(packPath, outFolder));
+
+		if (!packSink->IsValid())
 		{
-			FByteswapper(textures[i].containerID);
-			textures[i].containerID = containerLookups[textures[i].containerID];
+			printerror("Cannot create file: ", << packPath);
+			free(masterBuffer);
+			return 6;
 		}
 
-		if (CreateFile(outFolder + ToTSTRING(i) + _T(".camdo"), ofs))
+		map.sink = packSink.get();
+	}
+	else if (outputMode == Output_Tar && !writeIndex)
+		map.sink = tarSink.get();
+
+	map.sink->CreateFolder(outFolder);
+
+	std::unique_ptr<WriteBehindSink> writeBehindSink;
+	map.stagingFolder = stagingFolder;
+
+	// Folder output is staged within itself, so staged textures are handed over by rename
+	if (writeBehind && outputMode == Output_Folder && !writeIndex)
+	{
+		map.stagingFolder = CreateTempFolder(_T("casmExtract_"), outFolder);
+
+		if (map.stagingFolder.empty())
 		{
-			ofs.write(reinterpret_cast<char *>(&out), sizeof(MXMDHeader));
-			ofs.write(dataBuffer + sizeof(MapTerrainHeader), data[i].size - sizeof(MapTerrainHeader));
-			ofs.close();
+			printwarning("Cannot create temporary folder, write behind is disabled for: ", << outFolder);
 		}
 	}
 
-	free(dataBuffer);
-}
+	if (writeBehind && !map.sink->IsOrdered() && !writeIndex && !map.stagingFolder.empty())
+	{
+		writeBehindSink.reset(new WriteBehindSink(*map.sink, *writeBehind));
+		map.sink = writeBehindSink.get();
+	}
 
-void ExtractTGLD(DMSM *dmsm, const TSTRING &outFolder, BinReader *dataFile)
-{
-	std::ofstream ofs;
+	TaskGraph stages;
+	ReadPlan readPlan;
+	PlanReads(dmsm, readPlan);
 
-	if (CreateFile(outFolder + _T("main.tgld"), ofs))
-		ofs.write(dmsm->GetMainTGLD(), dmsm->GetMainTGLDSize());
+	const TSTRING stateFile = outFolder + _T("casmExtract.state");
+	bool stateLoaded = false;
 
-	ofs.close();
+	if (incremental && outputMode == Output_Folder && !writeIndex)
+	{
+		std::vector<FileStamp> sourceStamps(2);
 
-	int biggestSize = 0;
+		if (GetFileStamp(filePath, sourceStamps[0]) && GetFileStamp(dataFileName, sourceStamps[1]))
+		{
+			map.incremental = true;
+			stateLoaded = map.state.Load(stateFile, outFolder, sourceStamps);
+		}
+	}
 
-	TGLDEntry *data = dmsm->GetTGLD();
+	// Added first so it gets queued ahead of the stages, single item is read directly.
+	// With loaded state most of data is likely up to date, prefetching it all would defeat the purpose.
+	if (!singleAsset && !stateLoaded)
+		stages.Add([&]()
+		{
+			Stats::Scope scope("Prefetch");
+			readPlan.Prefetch(dataFile, mapPrefetchBudget);
+		});
 
-	for (int i = 0; i < dmsm->TGLDCount; i++)
-		if (data[i].size > biggestSize)
-			biggestSize = data[i].size;
+	if (writeIndex)
+	{
+		stages.Add([&]() { WriteIndex(dmsm, outFolder + _T("index.json"), &dataFile); });
+		stages.Run(ThreadPool::Global());
 
-	char *dataBuffer = static_cast<char *>(malloc(biggestSize));
+		free(masterBuffer);
 
-	for (int i = 0; i < dmsm->TGLDCount; i++)
+		return 0;
+	}
+
+	// Ordered output needs deterministic order of stages, so they're run one by one
+	TaskGraph::NodeID lastStage = -1;
+
+	auto addStage = [&](ThreadPool::Task task, TaskGraph::NodeID dependency = -1)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		if (map.sink->IsOrdered() && lastStage >= 0)
+			dependency = lastStage;
+
+		lastStage = dependency < 0 ? stages.Add(task) : stages.Add(task, { dependency });
+		return lastStage;
+	};
+
+	if (filters[Category_Objects].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderObjects = outFolder + _T("objects/");
+			map.sink->CreateFolder(outFolderObjects);
+			ExtractMapObjects(dmsm->GetObjectModels(), dmsm->objectModelsCount, dmsm->GetObjectBuffers(), dmsm->mapObjectBuffersCount, outFolderObjects, map);
+		});
 
-		if (CreateFile(outFolder + esStringConvert<TCHAR>(dmsm->GetTGLDName(i)) + _T(".tgld"), ofs))
-			ofs.write(dataBuffer, data[i].size);
+	if (filters[Category_Terrain].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderLOD = outFolder + _T("terrain/");
+			map.sink->CreateFolder(outFolderLOD);
+			ExtractMapTerrain(dmsm->GetTerrainModels(), dmsm->terrainModelsCount, dmsm->GetTerrainBuffers(), dmsm->mapTerrainBuffersCount, outFolderLOD, map);
+		});
+
+	TSTRING outFoldertex = outFolder + _T("textures/");
+
+	if (filters[Category_TerrainTextures].selected || filters[Category_ObjectTextures].selected)
+	{
+		const TaskGraph::NodeID texFolderCreated = addStage([&]() { map.sink->CreateFolder(outFoldertex); });
+
+		if (filters[Category_TerrainTextures].selected)
+			addStage([&]()
+			{
+				ExtractCachedTextures(dmsm->GetTerrainCachedTextures(), dmsm->GetTerrainTextures(), dmsm->terrainCachedTexturesCount, dmsm->terrainTexturesCount, outFoldertex, map);
+			}, texFolderCreated);
 
-		ofs.close();
+		if (filters[Category_ObjectTextures].selected)
+			addStage([&]()
+			{
+				ExtractUncachedTextures(dmsm->GetObjectTextures(), dmsm->objectTexturesCount, outFoldertex, map);
+			}, texFolderCreated);
 	}
 
-	free(dataBuffer);
-}
+	if (filters[Category_Skybox].selected)
+		addStage([&]() { ExtractSkyboxes(dmsm->GetSkyboxModels(), dmsm->skyboxModelsCount, outFolder, map); });
 
-void ExtractEffects(DataFile *data, int count, const TSTRING &outFolder, BinReader *dataFile)
-{
-	int biggestSize = 0;
+	addStage([&]()
+	{
+		Stats::Scope scope("ExtractMapFiles");
 
-	for (int i = 0; i < count; i++)
-		if (data[i].size > biggestSize)
-			biggestSize = data[i].size;
+		if (filters[Category_CEMS].Matches(-1, fleInf.GetFileName()))
+			WriteOutput(map, outFolder + fleInf.GetFileName() + _T(".cems"), { OutputPiece::Memory(dmsm->GetCEMS(), dmsm->CEMSSize()) });
 
-	char *dataBuffer = static_cast<char *>(malloc(biggestSize)); 
-	std::ofstream ofs;
+		if (filters[Category_LCMD].Matches(-1, fleInf.GetFileName()))
+			WriteOutput(map, outFolder + fleInf.GetFileName() + _T(".lcmd"), { OutputPiece::Memory(dmsm->GetLCMD(), dmsm->LCMDSize) });
+	});
 
-	for (int i = 0; i < count; i++)
+	if (filters[Category_TGLD].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderTGLD = outFolder + _T("TGLD/");
+			map.sink->CreateFolder(outFolderTGLD);
+			ExtractTGLD(dmsm, outFolderTGLD, map);
+		});
+
+	if (filters[Category_Effects].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderEff = outFolder + _T("effects/");
+			map.sink->CreateFolder(outFolderEff);
+			ExtractEffects(dmsm->GetEffectFiles(), dmsm->EFBCount, outFolderEff, map);
+		});
+
+	if (filters[Category_Collision].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderCol = outFolder + _T("collision/");
+			map.sink->CreateFolder(outFolderCol);
+			ExtractCollision(dmsm, outFolderCol, map);
+		});
+
+	if (filters[Category_TerrainLODs].selected)
+		addStage([&]()
+		{
+			TSTRING outFolderTerrainLODs = outFolder + _T("terrainLOD/");
+			map.sink->CreateFolder(outFolderTerrainLODs);
+			ExtractTerrainLODs(dmsm->GetTerrainLODs(), dmsm->terrainLODsCount, outFolderTerrainLODs, map);
+		});
+
+	stages.Run(ThreadPool::Global());
+
+	if (writeBehindSink)
+		for (auto &f : writeBehindSink->Flush())
+		{
+			printerror("Couldn't write file: ", << f);
+
+			if (map.incremental)
+				map.state.Forget(f);
+		}
+
+	if (map.stagingFolder != stagingFolder)
+		RemoveFolder(map.stagingFolder);
+
+	if (map.incremental && !map.state.Save(stateFile))
+		printerror("Couldn't write file: ", << stateFile);
+
+	if (packSink && !packSink->Finish())
+		printerror("Couldn't write file: ", << packPath);
+
+	free(masterBuffer);
+
+	return 0;
+}
+
+// Longest folder path all files share.
+TSTRING GetCommonFolder(const std::vector<TSTRING> &files)
+{
+	TSTRING commonFolder = TFileInfo(files[0]).GetPath();
+
+	for (auto &f : files)
 	{
-		dataFile->Seek(data[i].offset);
-		dataFile->ReadBuffer(dataBuffer, data[i].size);
+		const TSTRING folder = TFileInfo(f).GetPath();
 
-		if (CreateFile(outFolder + ToTSTRING(i) + _T(".epac"), ofs))
-			ofs.write(dataBuffer, data[i].size);
+		while (folder.compare(0, commonFolder.size(), commonFolder))
+		{
+			// root folder, or absolute and relative paths share nothing
+			if (commonFolder.size() < 2)
+				return TSTRING();
 
-		ofs.close();
+			const size_t lastSlash = commonFolder.find_last_of(_T("/\\"), commonFolder.size() - 2);
+			commonFolder.resize(lastSlash == commonFolder.npos ? 0 : lastSlash + 1);
+		}
 	}
 
-	free(dataBuffer);
+	return commonFolder;
+}
+
+// Standard output carries tar stream in tar mode.
+int PrintToStderr(const TCHAR *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+#ifdef UNICODE
+	const int result = vfwprintf(stderr, format, args);
+#else
+	const int result = vfprintf(stderr, format, args);
+#endif
+	va_end(args);
+
+	return result;
 }
 
 int _tmain(int argc, _TCHAR *argv[])
 {
 	setlocale(LC_ALL, "");
+
+	// Printer must be redirected before anything is printed
+	bool tarOutput = false;
+
+	for (int a = 1; a + 1 < argc; a++)
+		if (TSTRING(argv[a]) == _T("-o") && TSTRING(argv[a + 1]) == _T("tar"))
+			tarOutput = true;
+
+	if (tarOutput)
+		printer.AddPrinterFunction(reinterpret_cast<void*>(PrintToStderr));
+	else
+	{
 	#ifdef UNICODE
-	printer.AddPrinterFunction(wprintf);
+		printer.AddPrinterFunction(wprintf);
 	#else
-	printer.AddPrinterFunction(reinterpret_cast<void*>(printf));
+		printer.AddPrinterFunction(reinterpret_cast<void*>(printf));
 	#endif
+	}
 
 	printline("Xenoblade X CASM Extractor by Lukas Cone in 2019.\n");
 
@@ -938,13 +2068,14 @@ int _tmain(int argc, _TCHAR *argv[])
 		return 1;
 	}
 	
-	const TCHAR *filePath = nullptr;
+	std::vector<TSTRING> inputs;
 
 	for (int a = 1; a < argc; a++)
 	{
 		if (argv[a][0] == '-')
 		{
-			switch (argv[a][1])
+			// options are single letters, anything longer isn't taken for one of them
+			switch (argv[a][1] && !argv[a][2] ? argv[a][1] : 0)
 			{
 			case '?':
 			case 'h':
@@ -958,109 +2089,260 @@ int _tmain(int argc, _TCHAR *argv[])
 			case 'b':
 				texParams.allowBC5ZChan = true;
 				break;
+			case 'p':
+				sharedBuffers = true;
+				break;
+			case 'x':
+				writeIndex = true;
+				break;
+			case 's':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				statsFile = argv[++a];
+				break;
+			}
+			case 'i':
+				incremental = true;
+				break;
+			case 'm':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				const long budgetMB = _tcstol(argv[++a], nullptr, 10);
+
+				if (budgetMB < 1)
+				{
+					printerror("Invalid memory budget: ", << argv[a]);
+					return 2;
+				}
+
+				textureBudget = static_cast<size_t>(budgetMB) << 20;
+				break;
+			}
+			case 'w':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				numWriterThreads = _tcstol(argv[++a], nullptr, 10);
+
+				if (numWriterThreads < 0)
+				{
+					printerror("Invalid number of threads: ", << argv[a]);
+					return 2;
+				}
+
+				break;
+			}
+			case 'j':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				maxMapsInFlight = _tcstol(argv[++a], nullptr, 10);
+
+				if (maxMapsInFlight < 1)
+				{
+					printerror("Invalid number of maps: ", << argv[a]);
+					return 2;
+				}
+
+				break;
+			}
+			case 'o':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				const TSTRING modeName = argv[++a];
+
+				if (modeName == _T("folder"))
+					outputMode = Output_Folder;
+				else if (modeName == _T("pack"))
+					outputMode = Output_Pack;
+				else if (modeName == _T("tar"))
+					outputMode = Output_Tar;
+				else
+				{
+					printerror("Unknown output mode: ", << modeName);
+					return 2;
+				}
+
+				break;
+			}
+			case 'c':
+			case 'r':
+			case 'n':
+			case 'g':
+			{
+				if (a + 1 >= argc)
+				{
+					printerror("Missing value for argument: ", << argv[a]);
+					return 2;
+				}
+
+				const TCHAR filterType = argv[a][1];
+				const TSTRING filterValue = argv[++a];
+				const bool parsed = filterType == 'c' ? ParseCategoriesFilter(filterValue) :
+					filterType == 'r' ? ParseRangeFilter(filterValue) :
+					filterType == 'g' ? ParseGetFilter(filterValue) : ParseNameFilter(filterValue);
+
+				if (!parsed)
+					return 2;
+
+				break;
+			}
 			default:
 				printerror("Unrecognized argument: ", << argv[a]);
-				break;
+				return 2;
 			}
 		}
-		else if (filePath)
-		{
-			printerror("Unrecognized argument: ", << argv[a]);
-		}
 		else
-			filePath = argv[a];
+			inputs.push_back(argv[a]);
 	}
 
-	if (!filePath)
+	if (inputs.empty())
 	{
 		printerror("Missing <casmhd file> argument.");
 		return 2;
 	}
 
-	BinReader rd(filePath);
+	if (filtersUsed)
+		for (int c = 0; c < Category_Count; c++)
+			filters[c].selected = categoryMentioned[c];
 
-	if (!rd.IsValid())
+	if (!statsFile.empty())
+		Stats::Enable();
+
+	std::vector<std::pair<uint64_t, TSTRING>> files;
+
+	for (auto &i : inputs)
 	{
-		printerror("Cannot open file: ", << filePath);
-		return 3;
-	}
+		std::vector<TSTRING> found;
 
-	TFileInfo fleInf(filePath);
+		if (IsFolder(i))
+		{
+			found = ListFiles(i, _T(".casmhd"));
 
-	TSTRING dataFileName = fleInf.GetPath() + fleInf.GetFileName() + _T(".casmda");
-	BinReader dataFile(dataFileName);
+			if (found.empty())
+				printwarning("No casmhd files in folder: ", << i);
+		}
+		else
+			found.push_back(i);
 
-	if (!dataFile.IsValid())
-	{
-		printerror("Cannot open file: ", << dataFileName);
-		return 4;
+		for (auto &f : found)
+		{
+			TFileInfo fleInf(f);
+			FileStamp dataStamp = {};
+			GetFileStamp(fleInf.GetPath() + fleInf.GetFileName() + _T(".casmda"), dataStamp);
+			files.push_back({ dataStamp.size, f });
+		}
 	}
 
-	dataFile.SwapEndian(true);
+	if (files.empty())
+		return 2;
 
-	const size_t fleSize = rd.GetSize();
-	char *masterBuffer = static_cast<char *>(malloc(fleSize));
-	rd.ReadBuffer(masterBuffer, fleSize);
-	DMSM *dmsm = reinterpret_cast<DMSM *>(masterBuffer);
+	// Biggest maps go first, smaller ones fill the pool once big ones run out of parallel work
+	std::stable_sort(files.begin(), files.end(), [](const std::pair<uint64_t, TSTRING> &f0, const std::pair<uint64_t, TSTRING> &f1) { return f0.first > f1.first; });
 
-	if (dmsm->magic != DMSM::ID)
+	std::vector<TSTRING> filePaths;
+
+	for (auto &f : files)
+		filePaths.push_back(f.second);
+
+	if (numWriterThreads && outputMode != Output_Tar && !writeIndex)
+		writeBehind.reset(new WriteBehind(numWriterThreads, writeBehindBudget));
+
+	if (outputMode != Output_Folder && !writeIndex)
 	{
-		printerror("Invalid DMSM file.");
-		return 5;
-	}
+		if (outputMode == Output_Tar)
+		{
+#if _MSC_VER
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			int64_t newestTime = 0;
 
-	dmsm->SwapEndian();
+			for (auto &f : filePaths)
+				newestTime = std::max(newestTime, GetModifiedTime(f));
+
+			tarSink.reset(new TarSink(fileno(stdout), GetCommonFolder(filePaths), newestTime, tarBufferBudget));
+		}
 
-	printline("Extracting CASM file...");
+		stagingFolder = CreateTempFolder(_T("casmExtract_"));
 
-	TSTRING outFolder = fleInf.GetPath() + fleInf.GetFileName() + _T("/");
-	_tmkdir(outFolder.c_str());
+		if (stagingFolder.empty())
+		{
+			printerror("Cannot create temporary folder.");
+			return 6;
+		}
 
-	ExtractSkyboxes(dmsm->GetSkyboxModels(), dmsm->skyboxModelsCount, outFolder, &dataFile);
+		if (incremental && outputMode != Output_Folder)
+			printwarning("Incremental extraction is only available with folder output.");
+	}
 
-	std::ofstream ofs;
+	// Tar entries must come in the same order, so maps are extracted one by one
+	const int numLanes = outputMode == Output_Tar ? 1 : std::min(static_cast<int>(filePaths.size()), std::max(maxMapsInFlight, 1));
+	std::atomic<size_t> nextFile(0);
+	std::atomic<int> result(0);
 
-	if (CreateFile(outFolder + fleInf.GetFileName() + _T(".cems"), ofs))
-		ofs.write(dmsm->GetCEMS(), dmsm->CEMSSize());
+	mapPrefetchBudget = GetPrefetchBudget() / numLanes;
 
-	ofs.close();
+	// Lanes run on their own threads, not in the pool, so a map waiting for its stages
+	// helps only with pool tasks and never picks up another map.
+	auto runLane = [&]()
+	{
+		for (size_t f = nextFile++; f < filePaths.size(); f = nextFile++)
+		{
+			const int mapResult = ExtractMap(filePaths[f]);
 
-	if (CreateFile(outFolder + fleInf.GetFileName() + _T(".lcmd"), ofs))
-		ofs.write(dmsm->GetLCMD(), dmsm->LCMDSize);
+			if (mapResult)
+				result = mapResult;
+		}
+	};
 
-	ofs.close();
+	std::vector<std::thread> lanes;
 
-	TSTRING outFolderTGLD = outFolder + _T("TGLD/");
-	_tmkdir(outFolderTGLD.c_str());
-	ExtractTGLD(dmsm, outFolderTGLD, &dataFile);
+	for (int l = 1; l < numLanes; l++)
+		lanes.emplace_back(runLane);
 
-	TSTRING outFolderEff = outFolder + _T("effects/");
-	_tmkdir(outFolderEff.c_str());
-	ExtractEffects(dmsm->GetEffectFiles(), dmsm->EFBCount, outFolderEff, &dataFile);
+	runLane();
 
-	TSTRING outFolderLOD = outFolder + _T("terrain/");
-	_tmkdir(outFolderLOD.c_str());
-	ExtractMapTerrain(dmsm->GetTerrainModels(), dmsm->GetTerrainBuffers(), dmsm->terrainModelsCount, outFolderLOD, &dataFile);
+	for (auto &l : lanes)
+		l.join();
 
-	TSTRING outFoldertex = outFolder + _T("textures/");
-	_tmkdir(outFoldertex.c_str());
-	ExtractCachedTextures(dmsm->GetTerrainCachedTextures(), dmsm->GetTerrainTextures(), dmsm->terrainCachedTexturesCount, outFoldertex, &dataFile);
-	ExtractUncachedTextures(dmsm->GetObjectTextures(), dmsm->objectTexturesCount, outFoldertex, &dataFile);
+	if (tarSink && !tarSink->Finish())
+		printerror("Couldn't write file: <stdout>");
 
-	TSTRING outFolderObjects = outFolder + _T("objects/");
-	_tmkdir(outFolderObjects.c_str());
-	ExtractMapObjects(dmsm->GetObjectModels(), dmsm->GetObjectBuffers(), dmsm->objectModelsCount, outFolderObjects, &dataFile);
+	if (!stagingFolder.empty())
+		RemoveFolder(stagingFolder);
 
-	TSTRING outFolderCol = outFolder + _T("collision/");
-	_tmkdir(outFolderCol.c_str());
-	ExtractCollision(dmsm, outFolderCol, &dataFile);
+	if (!statsFile.empty())
+	{
+		printline(esStringConvert<TCHAR>(Stats::Report().c_str()));
 
-	TSTRING outFolderTerrainLODs = outFolder + _T("terrainLOD/");
-	_tmkdir(outFolderTerrainLODs.c_str());
-	ExtractTerrainLODs(dmsm->GetTerrainLODs(), dmsm->terrainLODsCount, outFolderTerrainLODs, &dataFile);
+		if (!Stats::SaveJSON(statsFile))
+			printerror("Couldn't write file: ", << statsFile);
+	}
 
-	free(masterBuffer);
 	printline("Done.");
 
-	return 0;
-}
\ No newline at end of file
+	return result;
+}
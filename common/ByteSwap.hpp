@@ -0,0 +1,228 @@
+/*  XenoToolset byte swapping
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BYTESWAP_X86 1
+#if _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define BYTESWAP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BYTESWAP_TARGET(isa)
+#endif
+
+enum class ByteSwapISA
+{
+	Scalar,
+	SSSE3,
+	AVX2
+};
+
+// Detected once, best instruction set available on this CPU.
+inline ByteSwapISA GetByteSwapISA();
+inline const char *GetByteSwapISAName(ByteSwapISA isa);
+
+// Swaps count of contiguous 16 or 32 bit items in place.
+inline void SwapBytes16(void *data, size_t count, ByteSwapISA isa = GetByteSwapISA());
+inline void SwapBytes32(void *data, size_t count, ByteSwapISA isa = GetByteSwapISA());
+
+// Swaps whole table of structures made only of 32 bit fields.
+template<class T> void SwapTable32(T *items, int count)
+{
+	static_assert(sizeof(T) % 4 == 0, "Structure must consist of 32 bit fields.");
+
+	if (count > 0)
+		SwapBytes32(items, sizeof(T) / 4 * count);
+}
+
+namespace ByteSwapDetail
+{
+inline void Swap16Scalar(char *data, size_t count)
+{
+	uint16_t *items = reinterpret_cast<uint16_t *>(data);
+
+	for (size_t i = 0; i < count; i++)
+		items[i] = static_cast<uint16_t>((items[i] >> 8) | (items[i] << 8));
+}
+
+inline void Swap32Scalar(char *data, size_t count)
+{
+	uint32_t *items = reinterpret_cast<uint32_t *>(data);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint32_t item = items[i];
+		items[i] = (item >> 24) | ((item >> 8) & 0xff00) | ((item << 8) & 0xff0000) | (item << 24);
+	}
+}
+
+#ifdef BYTESWAP_X86
+// Both kernels return number of bytes processed, rest is left for scalar path.
+BYTESWAP_TARGET("ssse3") inline size_t SwapSSSE3(char *data, size_t numBytes, bool words)
+{
+	const __m128i mask = words ?
+		_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+		_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t b = 0;
+
+	for (; b + 64 <= numBytes; b += 64)
+	{
+		__m128i *cur = reinterpret_cast<__m128i *>(data + b);
+		const __m128i v0 = _mm_loadu_si128(cur);
+		const __m128i v1 = _mm_loadu_si128(cur + 1);
+		const __m128i v2 = _mm_loadu_si128(cur + 2);
+		const __m128i v3 = _mm_loadu_si128(cur + 3);
+		_mm_storeu_si128(cur, _mm_shuffle_epi8(v0, mask));
+		_mm_storeu_si128(cur + 1, _mm_shuffle_epi8(v1, mask));
+		_mm_storeu_si128(cur + 2, _mm_shuffle_epi8(v2, mask));
+		_mm_storeu_si128(cur + 3, _mm_shuffle_epi8(v3, mask));
+	}
+
+	for (; b + 16 <= numBytes; b += 16)
+	{
+		__m128i *cur = reinterpret_cast<__m128i *>(data + b);
+		_mm_storeu_si128(cur, _mm_shuffle_epi8(_mm_loadu_si128(cur), mask));
+	}
+
+	return b;
+}
+
+BYTESWAP_TARGET("avx2") inline size_t SwapAVX2(char *data, size_t numBytes, bool words)
+{
+	// shuffle works within 128 bit lanes, mask is the same for both of them
+	const __m256i mask = words ?
+		_mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+		_mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t b = 0;
+
+	for (; b + 128 <= numBytes; b += 128)
+	{
+		__m256i *cur = reinterpret_cast<__m256i *>(data + b);
+		const __m256i v0 = _mm256_loadu_si256(cur);
+		const __m256i v1 = _mm256_loadu_si256(cur + 1);
+		const __m256i v2 = _mm256_loadu_si256(cur + 2);
+		const __m256i v3 = _mm256_loadu_si256(cur + 3);
+		_mm256_storeu_si256(cur, _mm256_shuffle_epi8(v0, mask));
+		_mm256_storeu_si256(cur + 1, _mm256_shuffle_epi8(v1, mask));
+		_mm256_storeu_si256(cur + 2, _mm256_shuffle_epi8(v2, mask));
+		_mm256_storeu_si256(cur + 3, _mm256_shuffle_epi8(v3, mask));
+	}
+
+	for (; b + 32 <= numBytes; b += 32)
+	{
+		__m256i *cur = reinterpret_cast<__m256i *>(data + b);
+		_mm256_storeu_si256(cur, _mm256_shuffle_epi8(_mm256_loadu_si256(cur), mask));
+	}
+
+	return b;
+}
+
+inline ByteSwapISA DetectISA()
+{
+#if _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	const int maxLeaf = regs[0];
+	__cpuid(regs, 1);
+
+	if (!(regs[2] & (1 << 9)))
+		return ByteSwapISA::Scalar;
+
+	const bool osAVX = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+
+	if (osAVX && maxLeaf >= 7)
+	{
+		__cpuidex(regs, 7, 0);
+
+		if (regs[1] & (1 << 5))
+			return ByteSwapISA::AVX2;
+	}
+
+	return ByteSwapISA::SSSE3;
+#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return ByteSwapISA::AVX2;
+
+	if (__builtin_cpu_supports("ssse3"))
+		return ByteSwapISA::SSSE3;
+
+	return ByteSwapISA::Scalar;
+#endif
+}
+#else
+inline ByteSwapISA DetectISA() { return ByteSwapISA::Scalar; }
+#endif
+
+inline size_t SwapVector(char *data, size_t numBytes, bool words, ByteSwapISA isa)
+{
+#ifdef BYTESWAP_X86
+	switch (isa)
+	{
+	case ByteSwapISA::AVX2:
+		return SwapAVX2(data, numBytes, words);
+	case ByteSwapISA::SSSE3:
+		return SwapSSSE3(data, numBytes, words);
+	default:
+		break;
+	}
+#endif
+	return 0;
+}
+}
+
+inline ByteSwapISA GetByteSwapISA()
+{
+	static const ByteSwapISA isa = ByteSwapDetail::DetectISA();
+	return isa;
+}
+
+inline const char *GetByteSwapISAName(ByteSwapISA isa)
+{
+	switch (isa)
+	{
+	case ByteSwapISA::AVX2:
+		return "AVX2";
+	case ByteSwapISA::SSSE3:
+		return "SSSE3";
+	default:
+		return "Scalar";
+	}
+}
+
+inline void SwapBytes16(void *data, size_t count, ByteSwapISA isa)
+{
+	char *bytes = static_cast<char *>(data);
+	const size_t done = ByteSwapDetail::SwapVector(bytes, count * 2, true, isa);
+	ByteSwapDetail::Swap16Scalar(bytes + done, count - done / 2);
+}
+
+inline void SwapBytes32(void *data, size_t count, ByteSwapISA isa)
+{
+	char *bytes = static_cast<char *>(data);
+	const size_t done = ByteSwapDetail::SwapVector(bytes, count * 4, false, isa);
+	ByteSwapDetail::Swap32Scalar(bytes + done, count - done / 4);
+}
@@ -0,0 +1,623 @@
+/*  XenoToolset file I/O
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "datas/esstring.h"
+#include "Stats.hpp"
+
+#if _MSC_VER
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <tchar.h>
+#include <io.h>
+#include <direct.h>
+#include <process.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Read only view of a whole file.
+// Falls back to positional reads when the file cannot be mapped (e.g. 32bit address space).
+class MappedFile
+{
+	int handle;
+	char *data;
+	size_t size;
+	bool copyOnWrite;
+#if _MSC_VER
+	HANDLE mapping;
+#endif
+public:
+	// With copyOnWrite, file is mapped privately and modified pages are never written back.
+	MappedFile(const TSTRING &filePath, bool copyOnWrite = false);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	ES_FORCEINLINE bool IsValid() const { return handle >= 0; }
+	ES_FORCEINLINE bool IsMapped() const { return data != nullptr; }
+	ES_FORCEINLINE int GetHandle() const { return handle; }
+	ES_FORCEINLINE size_t GetSize() const { return size; }
+	ES_FORCEINLINE const char *GetData() const { return data; }
+	// Returns nullptr unless file is mapped with copyOnWrite.
+	ES_FORCEINLINE char *GetPrivateData() const { return copyOnWrite ? data : nullptr; }
+
+	bool ReadAt(char *buffer, size_t offset, size_t readSize) const;
+
+	// Hints the OS that range will be read soon, doesn't block on I/O.
+	void Advise(size_t offset, size_t adviseSize) const;
+};
+
+// Unbuffered output file, able to move ranges of MappedFile without user space copies.
+class FileWriter
+{
+	int handle;
+	size_t position;
+	bool ownsHandle;
+public:
+	FileWriter() : handle(-1), position(0), ownsHandle(true) {}
+	FileWriter(const FileWriter &) = delete;
+	FileWriter &operator=(const FileWriter &) = delete;
+	~FileWriter() { Close(); }
+
+	bool Open(const TSTRING &filePath);
+	// Writes into already opened handle, e.g. standard output, which is left open by Close.
+	bool Attach(int fileHandle);
+	void Close();
+	ES_FORCEINLINE bool IsValid() const { return handle >= 0; }
+	ES_FORCEINLINE size_t Tell() const { return position; }
+
+	bool Write(const char *buffer, size_t writeSize);
+	// Moves forward without writing, skipped range reads as zeros.
+	bool Skip(size_t skipSize);
+	bool WriteRange(const MappedFile &source, size_t offset, size_t rangeSize);
+};
+
+// Creates destPath as hardlink of srcPath, falls back to copy where hardlinks aren't possible.
+// Returns false if srcPath doesn't exist.
+bool LinkOrCopyFile(const TSTRING &srcPath, const TSTRING &destPath);
+
+// Moves file, falls back to copy across volumes.
+bool MoveOrCopyFile(const TSTRING &srcPath, const TSTRING &destPath);
+
+bool RemoveFile(const TSTRING &filePath);
+bool RemoveFolder(const TSTRING &folderPath);
+
+// Creates new, uniquely named folder in system's temporary folder, returns it with trailing slash or empty string.
+// With parentFolder (ending with slash) it's created hidden in there instead, so files can be moved out of it by rename.
+TSTRING CreateTempFolder(const TSTRING &prefix, const TSTRING &parentFolder = TSTRING());
+
+bool IsFolder(const TSTRING &path);
+bool IsFile(const TSTRING &path);
+
+// Returns full paths of files directly within folder whose names end with extension, sorted by name.
+std::vector<TSTRING> ListFiles(const TSTRING &folderPath, const TSTRING &extension);
+
+// Returns full paths of files and folders directly within folder, both sorted by name.
+void ListFolder(const TSTRING &folderPath, std::vector<TSTRING> &files, std::vector<TSTRING> &folders);
+
+// Reads first 4 bytes of file, or last 4 bytes with atEnd.
+bool ReadFileMagic(const TSTRING &filePath, int &magic, bool atEnd = false);
+
+inline MappedFile::MappedFile(const TSTRING &filePath, bool inCopyOnWrite) : handle(-1), data(nullptr), size(0), copyOnWrite(inCopyOnWrite)
+{
+#if _MSC_VER
+	mapping = nullptr;
+	handle = _topen(filePath.c_str(), _O_RDONLY | _O_BINARY);
+
+	if (handle < 0)
+		return;
+
+	size = static_cast<size_t>(_filelengthi64(handle));
+
+	if (!size)
+		return;
+
+	mapping = CreateFileMapping(reinterpret_cast<HANDLE>(_get_osfhandle(handle)), nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+
+	if (mapping)
+		data = static_cast<char *>(MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+#else
+	handle = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (handle < 0)
+		return;
+
+	struct stat fileStat;
+
+	if (fstat(handle, &fileStat) || !fileStat.st_size)
+		return;
+
+	size = static_cast<size_t>(fileStat.st_size);
+
+	void *mapped = copyOnWrite ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, handle, 0) : mmap(nullptr, size, PROT_READ, MAP_SHARED, handle, 0);
+
+	if (mapped != MAP_FAILED)
+		data = static_cast<char *>(mapped);
+#endif
+}
+
+inline MappedFile::~MappedFile()
+{
+#if _MSC_VER
+	if (data)
+		UnmapViewOfFile(data);
+
+	if (mapping)
+		CloseHandle(mapping);
+
+	if (handle >= 0)
+		_close(handle);
+#else
+	if (data)
+		munmap(data, size);
+
+	if (handle >= 0)
+		close(handle);
+#endif
+}
+
+inline bool MappedFile::ReadAt(char *buffer, size_t offset, size_t readSize) const
+{
+	if (offset > size || readSize > size - offset)
+		return false;
+
+	Stats::AddRead(readSize);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, readSize);
+		return true;
+	}
+
+	while (readSize)
+	{
+#if _MSC_VER
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(static_cast<unsigned long long>(offset) >> 32);
+		DWORD numRead = 0;
+		const DWORD chunk = static_cast<DWORD>(std::min(readSize, static_cast<size_t>(0x40000000)));
+
+		if (!ReadFile(reinterpret_cast<HANDLE>(_get_osfhandle(handle)), buffer, chunk, &numRead, &overlapped) || !numRead)
+			return false;
+#else
+		const ssize_t numRead = pread(handle, buffer, readSize, offset);
+
+		if (numRead <= 0)
+			return false;
+#endif
+		buffer += numRead;
+		offset += numRead;
+		readSize -= numRead;
+	}
+
+	return true;
+}
+
+inline void MappedFile::Advise(size_t offset, size_t adviseSize) const
+{
+	if (offset >= size)
+		return;
+
+	adviseSize = std::min(adviseSize, size - offset);
+
+#if defined(__linux__)
+	posix_fadvise(handle, offset, adviseSize, POSIX_FADV_WILLNEED);
+#elif !_MSC_VER
+	if (!data)
+		return;
+
+	const size_t pageMask = static_cast<size_t>(sysconf(_SC_PAGESIZE)) - 1;
+	const size_t alignedOffset = offset & ~pageMask;
+
+	madvise(data + alignedOffset, adviseSize + offset - alignedOffset, MADV_WILLNEED);
+#endif
+}
+
+inline bool FileWriter::Open(const TSTRING &filePath)
+{
+	Close();
+#if _MSC_VER
+	handle = _topen(filePath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	handle = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+	return handle >= 0;
+}
+
+inline bool FileWriter::Attach(int fileHandle)
+{
+	Close();
+	handle = fileHandle;
+	ownsHandle = false;
+	return handle >= 0;
+}
+
+inline void FileWriter::Close()
+{
+	if (handle < 0)
+		return;
+
+	if (ownsHandle)
+	{
+#if _MSC_VER
+		_close(handle);
+#else
+		close(handle);
+#endif
+	}
+
+	handle = -1;
+	ownsHandle = true;
+	position = 0;
+}
+
+inline bool FileWriter::Write(const char *buffer, size_t writeSize)
+{
+	Stats::AddWritten(writeSize);
+
+	while (writeSize)
+	{
+#if _MSC_VER
+		const int written = _write(handle, buffer, static_cast<unsigned int>(std::min(writeSize, static_cast<size_t>(0x40000000))));
+#else
+		const ssize_t written = write(handle, buffer, writeSize);
+#endif
+		if (written <= 0)
+			return false;
+
+		buffer += written;
+		position += written;
+		writeSize -= written;
+	}
+
+	return true;
+}
+
+inline bool FileWriter::Skip(size_t skipSize)
+{
+	// File is written sequentially, so skipped range always ends past current end and file is extended over it
+#if _MSC_VER
+	if (_lseeki64(handle, skipSize, SEEK_CUR) < 0 || _chsize_s(handle, position + skipSize))
+		return false;
+#else
+	if (lseek(handle, skipSize, SEEK_CUR) < 0 || ftruncate(handle, position + skipSize))
+		return false;
+#endif
+	position += skipSize;
+	return true;
+}
+
+#ifdef __linux__
+// Errors meaning kernel or file systems can't copy between these files, anything else is a real failure.
+inline bool IsCopyUnsupported(int error)
+{
+	return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP;
+}
+#endif
+
+inline bool FileWriter::WriteRange(const MappedFile &source, size_t offset, size_t rangeSize)
+{
+	if (offset > source.GetSize() || rangeSize > source.GetSize() - offset)
+		return false;
+
+#ifdef __linux__
+	static std::atomic<bool> noCopyRange(false);
+	static std::atomic<bool> noSendFile(false);
+
+	while (rangeSize)
+	{
+		ssize_t copied = -1;
+		int error = ENOSYS;
+#ifdef __NR_copy_file_range
+		if (!noCopyRange)
+		{
+			loff_t inOffset = offset;
+			copied = syscall(__NR_copy_file_range, source.GetHandle(), &inOffset, handle, nullptr, rangeSize, 0);
+
+			if (copied < 0)
+			{
+				error = errno;
+
+				if (IsCopyUnsupported(error))
+					noCopyRange = true;
+			}
+		}
+#endif
+		if (copied < 0 && IsCopyUnsupported(error) && !noSendFile)
+		{
+			off_t inOffset = offset;
+			copied = sendfile(handle, source.GetHandle(), &inOffset, rangeSize);
+
+			if (copied < 0)
+			{
+				error = errno;
+
+				if (IsCopyUnsupported(error))
+					noSendFile = true;
+			}
+		}
+
+		if (copied < 0 && error == EINTR)
+			continue;
+
+		// e.g. ENOSPC or EIO would fail the same way with plain writes
+		if (copied < 0 && !IsCopyUnsupported(error))
+			return false;
+
+		if (copied <= 0)
+			break;
+
+		Stats::AddRead(copied);
+		Stats::AddWritten(copied);
+		offset += copied;
+		position += copied;
+		rangeSize -= copied;
+	}
+
+	if (!rangeSize)
+		return true;
+#endif
+
+	if (source.IsMapped())
+	{
+		Stats::AddRead(rangeSize);
+		return Write(source.GetData() + offset, rangeSize);
+	}
+
+	std::vector<char> bounceBuffer(std::min(rangeSize, static_cast<size_t>(0x100000)));
+
+	while (rangeSize)
+	{
+		const size_t chunk = std::min(rangeSize, bounceBuffer.size());
+
+		if (!source.ReadAt(bounceBuffer.data(), offset, chunk) || !Write(bounceBuffer.data(), chunk))
+			return false;
+
+		offset += chunk;
+		rangeSize -= chunk;
+	}
+
+	return true;
+}
+
+inline bool LinkOrCopyFile(const TSTRING &srcPath, const TSTRING &destPath)
+{
+#if _MSC_VER
+	DeleteFile(destPath.c_str());
+
+	if (CreateHardLink(destPath.c_str(), srcPath.c_str(), nullptr))
+		return true;
+#else
+	unlink(destPath.c_str());
+
+	if (!link(srcPath.c_str(), destPath.c_str()))
+		return true;
+#endif
+
+	MappedFile source(srcPath);
+	FileWriter wr;
+
+	return source.IsValid() && wr.Open(destPath) && wr.WriteRange(source, 0, source.GetSize());
+}
+
+inline bool MoveOrCopyFile(const TSTRING &srcPath, const TSTRING &destPath)
+{
+#if _MSC_VER
+	if (MoveFileEx(srcPath.c_str(), destPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+		return true;
+#else
+	if (!rename(srcPath.c_str(), destPath.c_str()))
+		return true;
+#endif
+
+	{
+		MappedFile source(srcPath);
+		FileWriter wr;
+
+		if (!source.IsValid() || !wr.Open(destPath) || !wr.WriteRange(source, 0, source.GetSize()))
+			return false;
+	}
+
+	return RemoveFile(srcPath);
+}
+
+inline bool RemoveFile(const TSTRING &filePath)
+{
+#if _MSC_VER
+	return DeleteFile(filePath.c_str()) != 0;
+#else
+	return !unlink(filePath.c_str());
+#endif
+}
+
+inline bool RemoveFolder(const TSTRING &folderPath)
+{
+#if _MSC_VER
+	return RemoveDirectory(folderPath.c_str()) != 0;
+#else
+	return !rmdir(folderPath.c_str());
+#endif
+}
+
+inline TSTRING CreateTempFolder(const TSTRING &prefix, const TSTRING &parentFolder)
+{
+#if _MSC_VER
+	TCHAR tempPath[MAX_PATH + 1];
+
+	if (parentFolder.empty() && !GetTempPath(MAX_PATH + 1, tempPath))
+		return TSTRING();
+
+	const TSTRING baseName = (parentFolder.empty() ? tempPath : parentFolder) + prefix + ToTSTRING(_getpid()) + _T("_") + ToTSTRING(GetTickCount()) + _T("_");
+
+	// never reuse existing folder, another name is tried instead
+	for (int t = 0; t < 100; t++)
+	{
+		const TSTRING folder = baseName + ToTSTRING(t) + _T("\\");
+
+		if (CreateDirectory(folder.c_str(), nullptr))
+		{
+			if (!parentFolder.empty())
+				SetFileAttributes(folder.c_str(), FILE_ATTRIBUTE_HIDDEN);
+
+			return folder;
+		}
+
+		if (GetLastError() != ERROR_ALREADY_EXISTS)
+			break;
+	}
+
+	return TSTRING();
+#else
+	const char *tempPath = getenv("TMPDIR");
+
+	if (!tempPath || !*tempPath)
+		tempPath = "/tmp";
+
+	std::string folder = (parentFolder.empty() ? tempPath + ("/" + prefix) : parentFolder + "." + prefix) + "XXXXXX";
+
+	if (!mkdtemp(&folder[0]))
+		return TSTRING();
+
+	return folder + "/";
+#endif
+}
+
+inline bool IsFolder(const TSTRING &path)
+{
+#if _MSC_VER
+	const DWORD attributes = GetFileAttributes(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat pathStat;
+	return !stat(path.c_str(), &pathStat) && S_ISDIR(pathStat.st_mode);
+#endif
+}
+
+inline bool IsFile(const TSTRING &path)
+{
+#if _MSC_VER
+	const DWORD attributes = GetFileAttributes(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat pathStat;
+	return !stat(path.c_str(), &pathStat) && S_ISREG(pathStat.st_mode);
+#endif
+}
+
+inline std::vector<TSTRING> ListFiles(const TSTRING &folderPath, const TSTRING &extension)
+{
+	std::vector<TSTRING> files,
+		folders,
+		matching;
+
+	ListFolder(folderPath, files, folders);
+
+	for (auto &f : files)
+		if (f.size() > extension.size() && !f.compare(f.size() - extension.size(), extension.size(), extension))
+			matching.push_back(f);
+
+	return matching;
+}
+
+inline void ListFolder(const TSTRING &folderPath, std::vector<TSTRING> &files, std::vector<TSTRING> &folders)
+{
+	TSTRING folder = folderPath;
+
+	if (!folder.empty() && folder.back() != '/' && folder.back() != '\\')
+		folder.push_back('/');
+
+	auto addEntry = [&](const TSTRING &name, bool isFolder)
+	{
+		if (name == _T(".") || name == _T(".."))
+			return;
+
+		(isFolder ? folders : files).push_back(folder + name);
+	};
+
+#if _MSC_VER
+	WIN32_FIND_DATA findData;
+	HANDLE findHandle = FindFirstFile((folder + _T("*")).c_str(), &findData);
+
+	if (findHandle != INVALID_HANDLE_VALUE)
+	{
+		do
+			addEntry(findData.cFileName, (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+		while (FindNextFile(findHandle, &findData));
+
+		FindClose(findHandle);
+	}
+#else
+	DIR *dir = opendir(folder.c_str());
+
+	if (dir)
+	{
+		// d_type saves stat of every entry, not all filesystems fill it
+		while (dirent *entry = readdir(dir))
+			addEntry(entry->d_name, entry->d_type == DT_UNKNOWN ? IsFolder(folder + entry->d_name) : entry->d_type == DT_DIR);
+
+		closedir(dir);
+	}
+#endif
+	std::sort(files.begin(), files.end());
+	std::sort(folders.begin(), folders.end());
+}
+
+inline bool ReadFileMagic(const TSTRING &filePath, int &magic, bool atEnd)
+{
+#if _MSC_VER
+	const int handle = _topen(filePath.c_str(), _O_RDONLY | _O_BINARY);
+
+	if (handle < 0)
+		return false;
+
+	const bool valid = (!atEnd || _lseeki64(handle, -4, SEEK_END) >= 0) && _read(handle, &magic, sizeof(magic)) == sizeof(magic);
+	_close(handle);
+#else
+	const int handle = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (handle < 0)
+		return false;
+
+	const bool valid = (!atEnd || lseek(handle, -4, SEEK_END) >= 0) && read(handle, &magic, sizeof(magic)) == sizeof(magic);
+	close(handle);
+#endif
+	return valid;
+}
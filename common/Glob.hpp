@@ -0,0 +1,51 @@
+/*  XenoToolset wildcard matching
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Matches whole str against pattern, where * matches any sequence and ? any single character.
+template<class C> bool GlobMatch(const C *pattern, const C *str)
+{
+	const C *starPattern = nullptr;
+	const C *starStr = nullptr;
+
+	while (*str)
+	{
+		if (*pattern == '*')
+		{
+			starPattern = ++pattern;
+			starStr = str;
+		}
+		else if (*pattern == '?' || *pattern == *str)
+		{
+			pattern++;
+			str++;
+		}
+		else if (starPattern)
+		{
+			pattern = starPattern;
+			str = ++starStr;
+		}
+		else
+			return false;
+	}
+
+	while (*pattern == '*')
+		pattern++;
+
+	return !*pattern;
+}
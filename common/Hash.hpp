@@ -0,0 +1,153 @@
+/*  XenoToolset content hashing
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Incremental 64bit XXH64 hash, for streamed data.
+class XXHash64
+{
+public:
+	XXHash64(uint64_t seed = 0);
+
+	void Update(const void *data, size_t dataSize);
+	uint64_t Digest() const;
+
+	static uint64_t Hash(const void *data, size_t dataSize, uint64_t seed = 0)
+	{
+		XXHash64 hasher(seed);
+		hasher.Update(data, dataSize);
+		return hasher.Digest();
+	}
+
+private:
+	static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+	static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+	uint64_t lanes[4];
+	uint64_t seed;
+	uint64_t totalSize;
+	unsigned char buffer[32];
+	size_t bufferSize;
+
+	static uint64_t RotateLeft(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+	static uint64_t Round(uint64_t lane, uint64_t input) { return RotateLeft(lane + input * prime2, 31) * prime1; }
+	static uint64_t MergeRound(uint64_t acc, uint64_t lane) { return (acc ^ Round(0, lane)) * prime1 + prime4; }
+
+	static uint64_t Read64(const unsigned char *data)
+	{
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	static uint32_t Read32(const unsigned char *data)
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	void ProcessStripe(const unsigned char *data)
+	{
+		lanes[0] = Round(lanes[0], Read64(data));
+		lanes[1] = Round(lanes[1], Read64(data + 8));
+		lanes[2] = Round(lanes[2], Read64(data + 16));
+		lanes[3] = Round(lanes[3], Read64(data + 24));
+	}
+};
+
+inline XXHash64::XXHash64(uint64_t inSeed) : seed(inSeed), totalSize(0), bufferSize(0)
+{
+	lanes[0] = seed + prime1 + prime2;
+	lanes[1] = seed + prime2;
+	lanes[2] = seed;
+	lanes[3] = seed - prime1;
+}
+
+inline void XXHash64::Update(const void *data, size_t dataSize)
+{
+	const unsigned char *iter = static_cast<const unsigned char *>(data);
+	totalSize += dataSize;
+
+	if (bufferSize)
+	{
+		const size_t toFill = 32 - bufferSize < dataSize ? 32 - bufferSize : dataSize;
+		memcpy(buffer + bufferSize, iter, toFill);
+		bufferSize += toFill;
+		iter += toFill;
+		dataSize -= toFill;
+
+		if (bufferSize < 32)
+			return;
+
+		ProcessStripe(buffer);
+		bufferSize = 0;
+	}
+
+	for (; dataSize >= 32; iter += 32, dataSize -= 32)
+		ProcessStripe(iter);
+
+	memcpy(buffer, iter, dataSize);
+	bufferSize = dataSize;
+}
+
+inline uint64_t XXHash64::Digest() const
+{
+	uint64_t result;
+
+	if (totalSize >= 32)
+	{
+		result = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+
+		for (int l = 0; l < 4; l++)
+			result = MergeRound(result, lanes[l]);
+	}
+	else
+		result = seed + prime5;
+
+	result += totalSize;
+
+	const unsigned char *iter = buffer;
+	size_t remaining = bufferSize;
+
+	for (; remaining >= 8; iter += 8, remaining -= 8)
+		result = RotateLeft(result ^ Round(0, Read64(iter)), 27) * prime1 + prime4;
+
+	if (remaining >= 4)
+	{
+		result = RotateLeft(result ^ (Read32(iter) * prime1), 23) * prime2 + prime3;
+		iter += 4;
+		remaining -= 4;
+	}
+
+	for (; remaining; iter++, remaining--)
+		result = RotateLeft(result ^ (*iter * prime5), 11) * prime1;
+
+	result ^= result >> 33;
+	result *= prime2;
+	result ^= result >> 29;
+	result *= prime3;
+	result ^= result >> 32;
+
+	return result;
+}
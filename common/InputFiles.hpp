@@ -0,0 +1,186 @@
+/*  XenoToolset input files
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include "datas/masterprinter.hpp"
+#include "FileIO.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+
+// Input files of tools given by command line arguments.
+// Argument is either file, folder searched recursively, @file with list of paths one per line, or - for such list from standard input.
+// Folders are walked by pool tasks in parallel, their files are handed out as soon as they're found.
+// Only files found in folders are checked by filter, files given explicitly are always handed out.
+class InputFiles
+{
+public:
+	typedef std::function<bool(const TSTRING &)> Filter;
+
+	InputFiles(ThreadPool &inPool, Filter inFilter) : pool(inPool), filter(inFilter), walkers(inPool) {}
+	InputFiles(const InputFiles &) = delete;
+	InputFiles &operator=(const InputFiles &) = delete;
+
+	void Add(const TSTRING &argument);
+	// Returns false once there are no more files, runs pool tasks while waiting for folder walks.
+	bool Next(TSTRING &filePath);
+
+private:
+	ThreadPool &pool;
+	Filter filter;
+	TaskGroup walkers;
+	std::deque<TSTRING> found;
+	std::mutex foundMutex;
+	std::deque<TSTRING> lists;
+	std::unique_ptr<std::ifstream> listFile;
+	std::istream *list = nullptr;
+
+	void Walk(const TSTRING &folder);
+	bool PopFound(TSTRING &filePath);
+	bool ReadList(TSTRING &filePath);
+};
+
+inline void InputFiles::Add(const TSTRING &argument)
+{
+	if (argument == _T("-") || (!argument.empty() && argument[0] == '@'))
+		lists.push_back(argument);
+	else if (IsFolder(argument))
+		walkers.Run([this, argument]() { Walk(argument); });
+	else
+	{
+		std::lock_guard<std::mutex> lock(foundMutex);
+		found.push_back(argument);
+	}
+}
+
+inline void InputFiles::Walk(const TSTRING &folder)
+{
+	Stats::Scope scope("FindInputs");
+	std::vector<TSTRING> files,
+		folders;
+
+	ListFolder(folder, files, folders);
+
+	for (auto &f : folders)
+		walkers.Run([this, f]() { Walk(f); });
+
+	for (auto &f : files)
+	{
+		if (!filter(f))
+			continue;
+
+		{
+			std::lock_guard<std::mutex> lock(foundMutex);
+			found.push_back(f);
+		}
+
+		pool.Notify();
+	}
+}
+
+inline bool InputFiles::PopFound(TSTRING &filePath)
+{
+	std::lock_guard<std::mutex> lock(foundMutex);
+
+	if (found.empty())
+		return false;
+
+	filePath = std::move(found.front());
+	found.pop_front();
+
+	return true;
+}
+
+// Lists are read line by line as files are requested, so conversion of listed files starts before whole list is read.
+inline bool InputFiles::ReadList(TSTRING &filePath)
+{
+	while (list || !lists.empty())
+	{
+		if (!list)
+		{
+			const TSTRING listName = lists.front();
+			lists.pop_front();
+
+			if (listName == _T("-"))
+				list = &std::cin;
+			else
+			{
+				listFile.reset(new std::ifstream(listName.substr(1)));
+
+				if (listFile->fail())
+				{
+					printerror("Couldn't load file: ", << listName.substr(1));
+					continue;
+				}
+
+				list = listFile.get();
+			}
+		}
+
+		std::string line;
+
+		if (!std::getline(*list, line))
+		{
+			list = nullptr;
+			listFile.reset();
+			continue;
+		}
+
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		if (line.empty())
+			continue;
+
+		const TSTRING path = esStringConvert<TCHAR>(line.c_str());
+
+		if (IsFolder(path))
+		{
+			walkers.Run([this, path]() { Walk(path); });
+			continue;
+		}
+
+		filePath = path;
+		return true;
+	}
+
+	return false;
+}
+
+inline bool InputFiles::Next(TSTRING &filePath)
+{
+	while (true)
+	{
+		if (PopFound(filePath) || ReadList(filePath))
+			return true;
+
+		// walkers add their files before they're done
+		if (walkers.IsDone())
+			return PopFound(filePath);
+
+		pool.HelpUntil([this]()
+		{
+			std::lock_guard<std::mutex> lock(foundMutex);
+			return !found.empty() || walkers.IsDone();
+		});
+	}
+}
@@ -0,0 +1,459 @@
+/*  XenoToolset output sinks
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FileIO.hpp"
+#include "PackFile.hpp"
+#include "WriteBehind.hpp"
+
+// Part of output file, either memory, range of source file, or zeros.
+struct OutputPiece
+{
+	const char *data;
+	const MappedFile *source;
+	size_t offset,
+		size;
+
+	static OutputPiece Memory(const void *data, size_t size) { return { static_cast<const char *>(data), nullptr, 0, size }; }
+	static OutputPiece Range(const MappedFile *source, size_t offset, size_t size) { return { nullptr, source, offset, size }; }
+	static OutputPiece Zeros(size_t size) { return { nullptr, nullptr, 0, size }; }
+};
+
+// Destination of extracted files, paths are full paths as if written into folders.
+// All methods are thread safe.
+// Ordered sinks emit entries in order of keys, reserved by Reserve in deterministic order and assigned to writes by OutputSlot.
+// Writes outside of any slot get their own key at time of the call.
+class OutputSink
+{
+public:
+	virtual ~OutputSink() {}
+
+	virtual bool IsValid() const { return true; }
+	virtual bool IsDirectory() const { return false; }
+	virtual bool IsOrdered() const { return false; }
+	virtual size_t Reserve(size_t) { return 0; }
+	virtual void Complete(size_t) {}
+	virtual void CreateFolder(const TSTRING &) {}
+
+	virtual bool Write(const TSTRING &path, const std::vector<OutputPiece> &pieces) = 0;
+	// Takes over file made outside of sink, e.g. by converter, stagedFile is gone afterwards.
+	virtual bool Ingest(const TSTRING &path, const TSTRING &stagedFile) = 0;
+	// Makes path with the same contents as already written targetPath.
+	virtual bool Link(const TSTRING &targetPath, const TSTRING &path) = 0;
+	virtual bool Finish() { return true; }
+};
+
+// Assigns key to all writes of current thread during its lifetime, key is completed at the end.
+class OutputSlot
+{
+public:
+	OutputSlot(OutputSink &inSink, size_t inKey) : sink(inSink), key(inKey), previous(Current())
+	{
+		if (sink.IsOrdered())
+			Current() = this;
+	}
+
+	OutputSlot(const OutputSlot &) = delete;
+	OutputSlot &operator=(const OutputSlot &) = delete;
+
+	~OutputSlot()
+	{
+		if (!sink.IsOrdered())
+			return;
+
+		Current() = previous;
+		sink.Complete(key);
+	}
+
+	// Returns false if no slot of sink is active on current thread.
+	static bool GetKey(const OutputSink &sink, size_t &outKey)
+	{
+		const OutputSlot *slot = Current();
+
+		if (!slot || &slot->sink != &sink)
+			return false;
+
+		outKey = slot->key;
+		return true;
+	}
+
+private:
+	OutputSink &sink;
+	size_t key;
+	OutputSlot *previous;
+
+	static OutputSlot *&Current()
+	{
+		static thread_local OutputSlot *current = nullptr;
+		return current;
+	}
+};
+
+// Converts full path into '/' separated UTF-8 name relative to rootFolder.
+inline std::string MakeEntryName(const TSTRING &rootFolder, const TSTRING &path)
+{
+	TSTRING relPath = path.compare(0, rootFolder.size(), rootFolder) ? path : path.substr(rootFolder.size());
+
+	for (auto &c : relPath)
+		if (c == '\\')
+			c = '/';
+
+	// paths outside of root stay absolute, entries are always relative
+	const size_t nameBegin = relPath.find_first_not_of('/');
+
+	return esStringConvert<char>(relPath.c_str() + (nameBegin == relPath.npos ? relPath.size() : nameBegin));
+}
+
+class DirectorySink : public OutputSink
+{
+public:
+	bool IsDirectory() const override { return true; }
+
+	void CreateFolder(const TSTRING &path) override
+	{
+#if _MSC_VER
+		CreateDirectory(path.c_str(), nullptr);
+#else
+		mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+#endif
+	}
+
+	bool Write(const TSTRING &path, const std::vector<OutputPiece> &pieces) override
+	{
+		FileWriter wr;
+
+		if (!wr.Open(path))
+			return false;
+
+		for (auto &p : pieces)
+		{
+			const bool written = p.data ? wr.Write(p.data, p.size) : p.source ? wr.WriteRange(*p.source, p.offset, p.size) : wr.Skip(p.size);
+
+			if (!written)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool Ingest(const TSTRING &path, const TSTRING &stagedFile) override { return MoveOrCopyFile(stagedFile, path); }
+	bool Link(const TSTRING &targetPath, const TSTRING &path) override { return LinkOrCopyFile(targetPath, path); }
+};
+
+// Hands writes of unordered sink over to WriteBehind threads, memory pieces are copied.
+// Folders are created on calling thread, links wait for writes handed over before them.
+class WriteBehindSink : public OutputSink
+{
+public:
+	WriteBehindSink(OutputSink &inInner, WriteBehind &inWriter) : inner(inInner), writer(inWriter), numPending(0) {}
+	~WriteBehindSink() { Flush(); }
+
+	bool IsValid() const override { return inner.IsValid(); }
+	void CreateFolder(const TSTRING &path) override { inner.CreateFolder(path); }
+
+	bool Write(const TSTRING &path, const std::vector<OutputPiece> &pieces) override;
+	bool Ingest(const TSTRING &path, const TSTRING &stagedFile) override;
+	bool Link(const TSTRING &targetPath, const TSTRING &path) override;
+
+	// Waits for all handed over writes, returns paths of those that failed.
+	std::vector<TSTRING> Flush();
+
+private:
+	OutputSink &inner;
+	WriteBehind &writer;
+	std::mutex pendingMutex;
+	std::condition_variable pendingDone;
+	size_t numPending;
+	std::vector<TSTRING> failedPaths;
+
+	void Submit(const TSTRING &path, std::function<bool()> job, size_t size);
+	void WaitPending();
+};
+
+inline void WriteBehindSink::Submit(const TSTRING &path, std::function<bool()> job, size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		numPending++;
+	}
+
+	writer.Submit([this, path, job]()
+	{
+		const bool written = job();
+		std::lock_guard<std::mutex> lock(pendingMutex);
+
+		if (!written)
+			failedPaths.push_back(path);
+
+		numPending--;
+		pendingDone.notify_all();
+	}, size);
+}
+
+inline void WriteBehindSink::WaitPending()
+{
+	std::unique_lock<std::mutex> lock(pendingMutex);
+	pendingDone.wait(lock, [this]() { return !numPending; });
+}
+
+inline bool WriteBehindSink::Write(const TSTRING &path, const std::vector<OutputPiece> &pieces)
+{
+	size_t memorySize = 0;
+
+	for (auto &p : pieces)
+		if (p.data)
+			memorySize += p.size;
+
+	auto ownedData = std::make_shared<std::vector<char>>();
+	ownedData->reserve(memorySize);
+	std::vector<OutputPiece> ownedPieces = pieces;
+
+	for (auto &p : ownedPieces)
+		if (p.data)
+		{
+			const size_t dataOffset = ownedData->size();
+			ownedData->insert(ownedData->end(), p.data, p.data + p.size);
+			p.data = ownedData->data() + dataOffset;
+		}
+
+	Submit(path, [this, path, ownedData, ownedPieces]() { return inner.Write(path, ownedPieces); }, memorySize);
+
+	return true;
+}
+
+inline bool WriteBehindSink::Ingest(const TSTRING &path, const TSTRING &stagedFile)
+{
+	Submit(path, [this, path, stagedFile]() { return inner.Ingest(path, stagedFile); }, 0);
+
+	return true;
+}
+
+inline bool WriteBehindSink::Link(const TSTRING &targetPath, const TSTRING &path)
+{
+	WaitPending();
+
+	return inner.Link(targetPath, path);
+}
+
+inline std::vector<TSTRING> WriteBehindSink::Flush()
+{
+	WaitPending();
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	std::vector<TSTRING> failed;
+	failed.swap(failedPaths);
+
+	return failed;
+}
+
+// Appends all files into single pack, see PackFile.hpp.
+class PackSink : public OutputSink
+{
+public:
+	static const uint32_t alignment = 64;
+
+	// Paths written into pack are stored relative to rootFolder.
+	PackSink(const TSTRING &packPath, const TSTRING &rootFolder);
+	~PackSink() { Finish(); }
+
+	bool IsValid() const override { return pack.IsValid(); }
+
+	bool Write(const TSTRING &path, const std::vector<OutputPiece> &pieces) override;
+	bool Ingest(const TSTRING &path, const TSTRING &stagedFile) override;
+	bool Link(const TSTRING &targetPath, const TSTRING &path) override;
+	bool Finish() override;
+
+private:
+	struct Entry
+	{
+		std::string name;
+		uint64_t offset,
+			size;
+	};
+
+	FileWriter pack;
+	TSTRING root;
+	std::vector<Entry> entries;
+	std::unordered_map<std::string, size_t> entryIDs;
+	std::mutex packMutex;
+	bool failed;
+
+	bool Pad(size_t padSize);
+	bool WriteZeros(size_t zerosSize);
+	void AddEntry(const std::string &name, uint64_t offset, uint64_t size);
+};
+
+inline PackSink::PackSink(const TSTRING &packPath, const TSTRING &rootFolder) : root(rootFolder), failed(false)
+{
+	if (!pack.Open(packPath))
+		return;
+
+	PackHeader header = {};
+	header.magic = PackHeader::ID;
+	header.version = PackHeader::VERSION;
+	header.alignment = alignment;
+
+	failed = !pack.Write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+inline bool PackSink::Pad(size_t padSize)
+{
+	static const char zeros[alignment] = {};
+
+	return !padSize || pack.Write(zeros, padSize);
+}
+
+inline bool PackSink::WriteZeros(size_t zerosSize)
+{
+	while (zerosSize)
+	{
+		const size_t chunk = zerosSize < alignment ? zerosSize : alignment;
+
+		if (!Pad(chunk))
+			return false;
+
+		zerosSize -= chunk;
+	}
+
+	return true;
+}
+
+inline void PackSink::AddEntry(const std::string &name, uint64_t offset, uint64_t size)
+{
+	auto found = entryIDs.find(name);
+
+	// rewritten entries keep their index slot, only data is appended again
+	if (found != entryIDs.end())
+	{
+		entries[found->second].offset = offset;
+		entries[found->second].size = size;
+		return;
+	}
+
+	entryIDs[name] = entries.size();
+	entries.push_back({ name, offset, size });
+}
+
+inline bool PackSink::Write(const TSTRING &path, const std::vector<OutputPiece> &pieces)
+{
+	const std::string name = MakeEntryName(root, path);
+	std::lock_guard<std::mutex> lock(packMutex);
+
+	if (!pack.IsValid() || failed)
+		return false;
+
+	if (!Pad((alignment - pack.Tell() % alignment) % alignment))
+	{
+		failed = true;
+		return false;
+	}
+
+	const size_t offset = pack.Tell();
+
+	for (auto &p : pieces)
+	{
+		// holes are written out, pack must stay append only
+		const bool written = p.data ? pack.Write(p.data, p.size) : p.source ? pack.WriteRange(*p.source, p.offset, p.size) : WriteZeros(p.size);
+
+		if (!written)
+		{
+			failed = true;
+			return false;
+		}
+	}
+
+	AddEntry(name, offset, pack.Tell() - offset);
+
+	return true;
+}
+
+inline bool PackSink::Ingest(const TSTRING &path, const TSTRING &stagedFile)
+{
+	bool written = false;
+
+	{
+		MappedFile staged(stagedFile);
+
+		if (staged.IsValid())
+			written = Write(path, { OutputPiece::Range(&staged, 0, staged.GetSize()) });
+	}
+
+	RemoveFile(stagedFile);
+
+	return written;
+}
+
+inline bool PackSink::Link(const TSTRING &targetPath, const TSTRING &path)
+{
+	const std::string targetName = MakeEntryName(root, targetPath);
+	const std::string name = MakeEntryName(root, path);
+	std::lock_guard<std::mutex> lock(packMutex);
+	auto found = entryIDs.find(targetName);
+
+	if (found == entryIDs.end())
+		return false;
+
+	const Entry target = entries[found->second];
+	AddEntry(name, target.offset, target.size);
+
+	return true;
+}
+
+inline bool PackSink::Finish()
+{
+	std::lock_guard<std::mutex> lock(packMutex);
+
+	if (!pack.IsValid())
+		return !failed;
+
+	PackTrailer trailer = {};
+	trailer.magic = PackTrailer::ID;
+	trailer.numEntries = static_cast<uint32_t>(entries.size());
+
+	if (!failed && Pad((alignment - pack.Tell() % alignment) % alignment))
+	{
+		trailer.indexOffset = pack.Tell();
+
+		for (auto &e : entries)
+		{
+			PackIndexEntry item = {};
+			item.offset = e.offset;
+			item.size = e.size;
+			item.nameSize = static_cast<uint32_t>(e.name.size());
+
+			if (!pack.Write(reinterpret_cast<const char *>(&item), sizeof(item)) || !pack.Write(e.name.data(), e.name.size()))
+			{
+				failed = true;
+				break;
+			}
+		}
+
+		trailer.indexSize = pack.Tell() - trailer.indexOffset;
+		failed = failed || !pack.Write(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+	}
+	else
+		failed = true;
+
+	pack.Close();
+
+	return !failed;
+}
@@ -0,0 +1,293 @@
+/*  XenoToolset incremental output state
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "FileIO.hpp"
+
+struct FileStamp
+{
+	uint64_t size;
+	int64_t modifiedTime;
+
+	bool operator==(const FileStamp &other) const { return size == other.size && modifiedTime == other.modifiedTime; }
+	bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
+
+// Returns false if file doesn't exist.
+inline bool GetFileStamp(const TSTRING &filePath, FileStamp &outStamp)
+{
+#if _MSC_VER
+	struct _stat64 fileStat;
+
+	if (_tstat64(filePath.c_str(), &fileStat))
+		return false;
+
+	outStamp.size = fileStat.st_size;
+	outStamp.modifiedTime = fileStat.st_mtime;
+#else
+	struct stat fileStat;
+
+	if (stat(filePath.c_str(), &fileStat))
+		return false;
+
+	outStamp.size = fileStat.st_size;
+#ifdef __linux__
+	outStamp.modifiedTime = static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000 + fileStat.st_mtim.tv_nsec;
+#else
+	outStamp.modifiedTime = fileStat.st_mtime;
+#endif
+#endif
+	return true;
+}
+
+// Remembers which source range and parameters every output was made from,
+// so outputs can be skipped when neither they nor their sources changed since.
+// Outputs are stored relative to root folder, the first output of an item is its key.
+class OutputState
+{
+public:
+	static const uint32_t ID = 0x41545343; // CSTA
+	static const uint32_t VERSION = 1;
+
+	// State is discarded, when any of source stamps differ from saved ones.
+	bool Load(const TSTRING &stateFile, const TSTRING &rootFolder, const std::vector<FileStamp> &sourceStamps);
+	bool Save(const TSTRING &stateFile) const;
+
+	bool IsUpToDate(const TSTRING &primaryOutput, int64_t sourceOffset, int64_t sourceSize, uint32_t params) const;
+	void Record(const std::vector<TSTRING> &outputs, int64_t sourceOffset, int64_t sourceSize, uint32_t params);
+	void Forget(const TSTRING &primaryOutput);
+
+private:
+	struct Entry
+	{
+		int64_t sourceOffset,
+			sourceSize;
+		uint32_t params;
+		std::vector<std::pair<TSTRING, uint64_t>> outputs;
+	};
+
+	TSTRING root;
+	std::vector<FileStamp> stamps;
+	std::map<TSTRING, Entry> entries;
+	mutable std::mutex entriesMutex;
+
+	TSTRING MakeRelative(const TSTRING &path) const
+	{
+		return path.compare(0, root.size(), root) ? path : path.substr(root.size());
+	}
+};
+
+namespace OutputStateDetail
+{
+template<class T> void Write(FILE *file, const T &value) { fwrite(&value, sizeof(T), 1, file); }
+template<class T> bool Read(FILE *file, T &value) { return fread(&value, sizeof(T), 1, file) == 1; }
+
+inline void WriteString(FILE *file, const TSTRING &str)
+{
+	Write(file, static_cast<uint32_t>(str.size()));
+	fwrite(str.c_str(), sizeof(TCHAR), str.size(), file);
+}
+
+inline bool ReadString(FILE *file, TSTRING &str)
+{
+	uint32_t strSize;
+
+	if (!Read(file, strSize) || strSize > 0x10000)
+		return false;
+
+	str.resize(strSize);
+	return fread(&str[0], sizeof(TCHAR), strSize, file) == strSize;
+}
+
+inline FILE *OpenFile(const TSTRING &filePath, bool write)
+{
+#if _MSC_VER
+	return _tfopen(filePath.c_str(), write ? _T("wb") : _T("rb"));
+#else
+	return fopen(filePath.c_str(), write ? "wb" : "rb");
+#endif
+}
+}
+
+inline bool OutputState::Load(const TSTRING &stateFile, const TSTRING &rootFolder, const std::vector<FileStamp> &sourceStamps)
+{
+	using namespace OutputStateDetail;
+
+	root = rootFolder;
+	stamps = sourceStamps;
+	entries.clear();
+
+	FILE *file = OpenFile(stateFile, false);
+
+	if (!file)
+		return false;
+
+	uint32_t magic, version, charSize, numStamps, numEntries;
+	bool valid = Read(file, magic) && magic == ID && Read(file, version) && version == VERSION &&
+		Read(file, charSize) && charSize == sizeof(TCHAR) && Read(file, numStamps) && numStamps == stamps.size();
+
+	for (uint32_t s = 0; valid && s < numStamps; s++)
+	{
+		FileStamp savedStamp;
+		valid = Read(file, savedStamp.size) && Read(file, savedStamp.modifiedTime) && savedStamp == stamps[s];
+	}
+
+	valid = valid && Read(file, numEntries);
+
+	for (uint32_t e = 0; valid && e < numEntries; e++)
+	{
+		TSTRING key;
+		Entry entry;
+		uint32_t numOutputs;
+		valid = ReadString(file, key) && Read(file, entry.sourceOffset) && Read(file, entry.sourceSize) && Read(file, entry.params) && Read(file, numOutputs);
+
+		for (uint32_t o = 0; valid && o < numOutputs; o++)
+		{
+			std::pair<TSTRING, uint64_t> output;
+			valid = ReadString(file, output.first) && Read(file, output.second);
+			entry.outputs.push_back(output);
+		}
+
+		if (valid)
+			entries[key] = entry;
+	}
+
+	fclose(file);
+
+	if (!valid)
+		entries.clear();
+
+	return valid;
+}
+
+inline bool OutputState::Save(const TSTRING &stateFile) const
+{
+	using namespace OutputStateDetail;
+
+	// Written aside and swapped in, so interrupted save doesn't leave broken state
+	const TSTRING tempFile = stateFile + _T(".tmp");
+	FILE *file = OpenFile(tempFile, true);
+
+	if (!file)
+		return false;
+
+	const uint32_t magic = ID;
+	const uint32_t version = VERSION;
+	Write(file, magic);
+	Write(file, version);
+	Write(file, static_cast<uint32_t>(sizeof(TCHAR)));
+	Write(file, static_cast<uint32_t>(stamps.size()));
+
+	for (auto &s : stamps)
+	{
+		Write(file, s.size);
+		Write(file, s.modifiedTime);
+	}
+
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	Write(file, static_cast<uint32_t>(entries.size()));
+
+	for (auto &e : entries)
+	{
+		WriteString(file, e.first);
+		Write(file, e.second.sourceOffset);
+		Write(file, e.second.sourceSize);
+		Write(file, e.second.params);
+		Write(file, static_cast<uint32_t>(e.second.outputs.size()));
+
+		for (auto &o : e.second.outputs)
+		{
+			WriteString(file, o.first);
+			Write(file, o.second);
+		}
+	}
+
+	const bool written = !ferror(file);
+
+	if (fclose(file) || !written)
+		return false;
+
+#if _MSC_VER
+	return MoveFileEx(tempFile.c_str(), stateFile.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return !rename(tempFile.c_str(), stateFile.c_str());
+#endif
+}
+
+inline bool OutputState::IsUpToDate(const TSTRING &primaryOutput, int64_t sourceOffset, int64_t sourceSize, uint32_t params) const
+{
+	std::unique_lock<std::mutex> lock(entriesMutex);
+	auto found = entries.find(MakeRelative(primaryOutput));
+
+	if (found == entries.end())
+		return false;
+
+	const Entry entry = found->second;
+	lock.unlock();
+
+	if (entry.sourceOffset != sourceOffset || entry.sourceSize != sourceSize || entry.params != params)
+		return false;
+
+	for (auto &o : entry.outputs)
+	{
+		FileStamp outputStamp;
+
+		if (!GetFileStamp(root + o.first, outputStamp) || outputStamp.size != o.second)
+			return false;
+	}
+
+	return true;
+}
+
+inline void OutputState::Record(const std::vector<TSTRING> &outputs, int64_t sourceOffset, int64_t sourceSize, uint32_t params)
+{
+	if (outputs.empty())
+		return;
+
+	Entry entry;
+	entry.sourceOffset = sourceOffset;
+	entry.sourceSize = sourceSize;
+	entry.params = params;
+
+	for (auto &o : outputs)
+	{
+		FileStamp outputStamp;
+
+		// Incomplete item is rather forgotten, so it gets extracted next time
+		if (!GetFileStamp(o, outputStamp))
+		{
+			Forget(outputs[0]);
+			return;
+		}
+
+		entry.outputs.push_back({ MakeRelative(o), outputStamp.size });
+	}
+
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	entries[MakeRelative(outputs[0])] = std::move(entry);
+}
+
+inline void OutputState::Forget(const TSTRING &primaryOutput)
+{
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	entries.erase(MakeRelative(primaryOutput));
+}
@@ -0,0 +1,137 @@
+/*  XenoToolset pack file
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "FileIO.hpp"
+
+/*	Layout, little endian:
+	PackHeader
+	entries data, every entry starts at PackHeader::alignment boundary
+	index: PackIndexEntry followed by nameSize bytes of UTF-8 name, for every entry
+	PackTrailer, at the very end of file
+
+	Names are relative paths with / separators. Several names can point to the same data.
+*/
+
+struct PackHeader
+{
+	static const uint32_t ID = 0x4B505458; // XTPK
+	static const uint32_t VERSION = 1;
+
+	uint32_t magic,
+		version,
+		alignment,
+		reserved[13];
+};
+
+struct PackIndexEntry
+{
+	uint64_t offset,
+		size;
+	uint32_t nameSize,
+		reserved;
+};
+
+struct PackTrailer
+{
+	static const uint32_t ID = 0x49505458; // XTPI
+
+	uint32_t magic,
+		numEntries;
+	uint64_t indexOffset,
+		indexSize,
+		reserved;
+};
+
+static_assert(sizeof(PackHeader) == 64, "Invalid PackHeader size.");
+static_assert(sizeof(PackIndexEntry) == 24, "Invalid PackIndexEntry size.");
+static_assert(sizeof(PackTrailer) == 32, "Invalid PackTrailer size.");
+
+// Read only access to pack, entries' data are served straight from the file mapping.
+class PackReader
+{
+public:
+	struct Entry
+	{
+		uint64_t offset,
+			size;
+	};
+
+	PackReader(const TSTRING &filePath);
+
+	ES_FORCEINLINE bool IsValid() const { return valid; }
+	ES_FORCEINLINE const std::unordered_map<std::string, Entry> &Entries() const { return entries; }
+
+	const Entry *Find(const std::string &name) const
+	{
+		auto found = entries.find(name);
+		return found == entries.end() ? nullptr : &found->second;
+	}
+
+	// Returns nullptr if pack couldn't be mapped, use Read then.
+	const char *GetData(const Entry &entry) const { return file.IsMapped() ? file.GetData() + entry.offset : nullptr; }
+	bool Read(const Entry &entry, char *buffer) const { return file.ReadAt(buffer, static_cast<size_t>(entry.offset), static_cast<size_t>(entry.size)); }
+
+private:
+	MappedFile file;
+	std::unordered_map<std::string, Entry> entries;
+	bool valid;
+};
+
+inline PackReader::PackReader(const TSTRING &filePath) : file(filePath), valid(false)
+{
+	PackHeader header;
+	PackTrailer trailer;
+
+	if (!file.IsValid() || file.GetSize() < sizeof(PackHeader) + sizeof(PackTrailer) ||
+		!file.ReadAt(reinterpret_cast<char *>(&header), 0, sizeof(header)) ||
+		!file.ReadAt(reinterpret_cast<char *>(&trailer), file.GetSize() - sizeof(trailer), sizeof(trailer)))
+		return;
+
+	if (header.magic != PackHeader::ID || header.version != PackHeader::VERSION || trailer.magic != PackTrailer::ID ||
+		trailer.indexOffset + trailer.indexSize > file.GetSize() - sizeof(trailer))
+		return;
+
+	std::string index(static_cast<size_t>(trailer.indexSize), '\0');
+
+	if (!file.ReadAt(&index[0], static_cast<size_t>(trailer.indexOffset), index.size()))
+		return;
+
+	size_t cursor = 0;
+
+	for (uint32_t e = 0; e < trailer.numEntries; e++)
+	{
+		PackIndexEntry item;
+
+		if (cursor + sizeof(item) > index.size())
+			return;
+
+		memcpy(&item, index.data() + cursor, sizeof(item));
+		cursor += sizeof(item);
+
+		if (cursor + item.nameSize > index.size() || item.offset + item.size > trailer.indexOffset)
+			return;
+
+		entries[index.substr(cursor, item.nameSize)] = { item.offset, item.size };
+		cursor += item.nameSize;
+	}
+
+	valid = true;
+}
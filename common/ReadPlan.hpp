@@ -0,0 +1,130 @@
+/*  XenoToolset read planner
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "FileIO.hpp"
+
+// Collects every range that is going to be read from a file,
+// then merges them into few sequential extents that can be prefetched in file order.
+class ReadPlan
+{
+public:
+	struct Extent
+	{
+		uint64_t offset,
+			size;
+	};
+
+	void Add(uint64_t offset, uint64_t size)
+	{
+		if (size)
+			extents.push_back({ offset, size });
+	}
+
+	// Adds items of a table with offset and size members, negative ones are skipped.
+	template<class T> void AddTable(const T *items, int count)
+	{
+		for (int i = 0; i < count; i++)
+			if (items[i].offset >= 0 && items[i].size > 0)
+				Add(items[i].offset, items[i].size);
+	}
+
+	// Sorts extents and merges the ones closer than mergeGap bytes.
+	void Finalize(uint64_t mergeGap = 0x10000);
+
+	// Issues readahead hints for extents in file order, up to budget bytes.
+	void Prefetch(const MappedFile &file, uint64_t budget) const;
+
+	const std::vector<Extent> &Extents() const { return extents; }
+	uint64_t TotalSize() const;
+
+private:
+	std::vector<Extent> extents;
+};
+
+// Half of physical memory, so prefetched data isn't evicted before it's used.
+inline uint64_t GetPrefetchBudget()
+{
+#if _MSC_VER
+	MEMORYSTATUSEX memStatus = {};
+	memStatus.dwLength = sizeof(memStatus);
+
+	if (GlobalMemoryStatusEx(&memStatus))
+		return memStatus.ullTotalPhys / 2;
+
+	return 0;
+#else
+	const long numPages = sysconf(_SC_PHYS_PAGES);
+	const long pageSize = sysconf(_SC_PAGESIZE);
+
+	if (numPages < 0 || pageSize < 0)
+		return 0;
+
+	return static_cast<uint64_t>(numPages) * pageSize / 2;
+#endif
+}
+
+inline void ReadPlan::Finalize(uint64_t mergeGap)
+{
+	if (extents.empty())
+		return;
+
+	std::sort(extents.begin(), extents.end(), [](const Extent &e0, const Extent &e1) { return e0.offset < e1.offset; });
+
+	size_t last = 0;
+
+	for (size_t e = 1; e < extents.size(); e++)
+	{
+		Extent &cur = extents[last];
+		const Extent &next = extents[e];
+		const uint64_t curEnd = cur.offset + cur.size;
+
+		if (next.offset <= curEnd + mergeGap)
+			cur.size = std::max(curEnd, next.offset + next.size) - cur.offset;
+		else
+			extents[++last] = next;
+	}
+
+	extents.resize(last + 1);
+}
+
+inline uint64_t ReadPlan::TotalSize() const
+{
+	uint64_t total = 0;
+
+	for (auto &e : extents)
+		total += e.size;
+
+	return total;
+}
+
+inline void ReadPlan::Prefetch(const MappedFile &file, uint64_t budget) const
+{
+	static const uint64_t maxAdviseSize = 0x1000000;
+
+	for (auto &e : extents)
+		for (uint64_t offset = e.offset; offset < e.offset + e.size && budget; )
+		{
+			const uint64_t adviseSize = std::min(std::min(maxAdviseSize, e.offset + e.size - offset), budget);
+			file.Advise(static_cast<size_t>(offset), static_cast<size_t>(adviseSize));
+			offset += adviseSize;
+			budget -= adviseSize;
+		}
+}
@@ -0,0 +1,436 @@
+/*  XenoToolset run statistics
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include "datas/esstring.h"
+
+#if _MSC_VER
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#include <sys/stat.h>
+#else
+#include <ctime>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+// Per stage statistics of a run, nothing is collected until Enable is called.
+// Stage is measured by Scope on calling thread, data counted meanwhile are attributed to innermost Scope.
+// Wall time is elapsed time of Scope, including nested ones. CPU time is exclusive,
+// while nested Scope is active (e.g. pool task helped within a wait), outer one is paused.
+// Pool tasks of a stage use their own Scope name, so stage calls and wall time aren't mixed with tasks.
+class Stats
+{
+public:
+	struct Counters
+	{
+		uint64_t calls = 0,
+			bytesRead = 0,
+			bytesWritten = 0,
+			filesCreated = 0,
+			peakRSS = 0;
+		double wallTime = 0.0,
+			cpuTime = 0.0;
+		// "<container>-><output type>" : count
+		std::map<std::string, uint64_t> textures;
+
+		void Merge(const Counters &other);
+	};
+
+	class Scope
+	{
+	public:
+		Scope(const char *stageName);
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+		~Scope();
+
+	private:
+		friend class Stats;
+
+		const char *name;
+		Scope *parent;
+		Counters counters;
+		std::chrono::steady_clock::time_point wallStart;
+		double cpuStart;
+		bool active;
+
+		void Pause();
+		void Resume();
+	};
+
+	static void Enable();
+	static bool IsEnabled() { return Get().enabled.load(std::memory_order_relaxed); }
+
+	static void AddRead(uint64_t size);
+	static void AddWritten(uint64_t size);
+	static void AddFile();
+	// For files read or written by someone else, e.g. XenoLib, counts the file and its size.
+	static void AddInputFile(const TSTRING &filePath);
+	static void AddOutputFile(const TSTRING &filePath);
+	static void AddTexture(const char *container, const char *outputType);
+
+	// Human readable table of all stages and totals.
+	static std::string Report();
+	static bool SaveJSON(const TSTRING &fileName);
+
+	static double GetThreadCPUTime();
+	static double GetProcessCPUTime();
+	static uint64_t GetPeakRSS();
+
+private:
+	std::atomic<bool> enabled;
+	std::mutex stagesMutex;
+	std::map<std::string, Counters> stages;
+	std::chrono::steady_clock::time_point runStart;
+
+	Stats() : enabled(false) {}
+	static Stats &Get()
+	{
+		static Stats instance;
+		return instance;
+	}
+
+	static Scope *&Current()
+	{
+		static thread_local Scope *current = nullptr;
+		return current;
+	}
+
+	// Counters of innermost Scope, data counted out of any Scope go into shared "Other" stage.
+	template<class Func> static void Count(Func func);
+	static uint64_t GetFileSize(const TSTRING &filePath);
+	// Sum of all stages with times and memory of whole process, stage times overlap across threads.
+	// Must be called under stagesMutex.
+	Counters Total() const;
+};
+
+inline void Stats::Counters::Merge(const Counters &other)
+{
+	calls += other.calls;
+	bytesRead += other.bytesRead;
+	bytesWritten += other.bytesWritten;
+	filesCreated += other.filesCreated;
+	peakRSS = peakRSS > other.peakRSS ? peakRSS : other.peakRSS;
+	wallTime += other.wallTime;
+	cpuTime += other.cpuTime;
+
+	for (auto &t : other.textures)
+		textures[t.first] += t.second;
+}
+
+inline Stats::Scope::Scope(const char *stageName) : name(stageName), parent(nullptr), cpuStart(0.0), active(IsEnabled())
+{
+	if (!active)
+		return;
+
+	parent = Current();
+
+	if (parent)
+		parent->Pause();
+
+	Current() = this;
+	counters.calls = 1;
+	wallStart = std::chrono::steady_clock::now();
+	Resume();
+}
+
+inline Stats::Scope::~Scope()
+{
+	if (!active)
+		return;
+
+	Pause();
+	counters.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	counters.peakRSS = GetPeakRSS();
+
+	{
+		Stats &stats = Get();
+		std::lock_guard<std::mutex> lock(stats.stagesMutex);
+		stats.stages[name].Merge(counters);
+	}
+
+	Current() = parent;
+
+	if (parent)
+		parent->Resume();
+}
+
+inline void Stats::Scope::Pause()
+{
+	counters.cpuTime += GetThreadCPUTime() - cpuStart;
+}
+
+inline void Stats::Scope::Resume()
+{
+	cpuStart = GetThreadCPUTime();
+}
+
+inline void Stats::Enable()
+{
+	Stats &stats = Get();
+	stats.runStart = std::chrono::steady_clock::now();
+	stats.enabled = true;
+}
+
+template<class Func> void Stats::Count(Func func)
+{
+	if (!IsEnabled())
+		return;
+
+	if (Scope *scope = Current())
+	{
+		func(scope->counters);
+		return;
+	}
+
+	Stats &stats = Get();
+	std::lock_guard<std::mutex> lock(stats.stagesMutex);
+	func(stats.stages["Other"]);
+}
+
+inline void Stats::AddRead(uint64_t size)
+{
+	Count([size](Counters &c) { c.bytesRead += size; });
+}
+
+inline void Stats::AddWritten(uint64_t size)
+{
+	Count([size](Counters &c) { c.bytesWritten += size; });
+}
+
+inline void Stats::AddFile()
+{
+	Count([](Counters &c) { c.filesCreated++; });
+}
+
+inline uint64_t Stats::GetFileSize(const TSTRING &filePath)
+{
+#if _MSC_VER
+	struct _stat64 fileStat;
+	return _tstat64(filePath.c_str(), &fileStat) ? 0 : fileStat.st_size;
+#else
+	struct stat fileStat;
+	return stat(filePath.c_str(), &fileStat) ? 0 : fileStat.st_size;
+#endif
+}
+
+inline void Stats::AddInputFile(const TSTRING &filePath)
+{
+	if (!IsEnabled())
+		return;
+
+	AddRead(GetFileSize(filePath));
+}
+
+inline void Stats::AddOutputFile(const TSTRING &filePath)
+{
+	if (!IsEnabled())
+		return;
+
+	const uint64_t size = GetFileSize(filePath);
+
+	Count([size](Counters &c)
+	{
+		c.filesCreated++;
+		c.bytesWritten += size;
+	});
+}
+
+inline void Stats::AddTexture(const char *container, const char *outputType)
+{
+	if (!IsEnabled())
+		return;
+
+	const std::string key = std::string(container) + "->" + outputType;
+
+	Count([&key](Counters &c) { c.textures[key]++; });
+}
+
+inline double Stats::GetThreadCPUTime()
+{
+#if _MSC_VER
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+
+	if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0.0;
+
+	return ((static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32 | kernelTime.dwLowDateTime) +
+		(static_cast<uint64_t>(userTime.dwHighDateTime) << 32 | userTime.dwLowDateTime)) * 1e-7;
+#else
+	timespec time;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time))
+		return 0.0;
+
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+inline double Stats::GetProcessCPUTime()
+{
+#if _MSC_VER
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0.0;
+
+	return ((static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32 | kernelTime.dwLowDateTime) +
+		(static_cast<uint64_t>(userTime.dwHighDateTime) << 32 | userTime.dwLowDateTime)) * 1e-7;
+#else
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0.0;
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+// Peak resident set size of whole process so far, in bytes.
+inline uint64_t Stats::GetPeakRSS()
+{
+#if _MSC_VER
+	PROCESS_MEMORY_COUNTERS counters = {};
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+inline Stats::Counters Stats::Total() const
+{
+	Counters total;
+
+	for (auto &s : stages)
+		total.Merge(s.second);
+
+	total.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+	total.cpuTime = GetProcessCPUTime();
+	total.peakRSS = GetPeakRSS();
+
+	return total;
+}
+
+inline std::string Stats::Report()
+{
+	Stats &stats = Get();
+	std::lock_guard<std::mutex> lock(stats.stagesMutex);
+	const Counters total = stats.Total();
+	std::string report;
+	char line[256];
+
+	auto addLine = [&](const std::string &name, const Counters &c)
+	{
+		snprintf(line, sizeof(line), "%-32s %8llu %10.3f %10.3f %12.2f %12.2f %8llu %10.2f\n", name.c_str(), static_cast<unsigned long long>(c.calls),
+			c.wallTime, c.cpuTime, c.bytesRead / 1048576.0, c.bytesWritten / 1048576.0, static_cast<unsigned long long>(c.filesCreated), c.peakRSS / 1048576.0);
+		report += line;
+	};
+
+	snprintf(line, sizeof(line), "%-32s %8s %10s %10s %12s %12s %8s %10s\n", "Stage", "Calls", "Wall[s]", "CPU[s]", "Read[MB]", "Written[MB]", "Files", "RSS[MB]");
+	report += line;
+
+	for (auto &s : stats.stages)
+		addLine(s.first, s.second);
+
+	addLine("Total", total);
+
+	for (auto &t : total.textures)
+	{
+		snprintf(line, sizeof(line), "Textures %s: %llu\n", t.first.c_str(), static_cast<unsigned long long>(t.second));
+		report += line;
+	}
+
+	return report;
+}
+
+inline bool Stats::SaveJSON(const TSTRING &fileName)
+{
+	Stats &stats = Get();
+	std::ofstream ofs(fileName);
+
+	if (ofs.fail())
+		return false;
+
+	std::lock_guard<std::mutex> lock(stats.stagesMutex);
+
+	auto writeCounters = [&](const Counters &c, const char *indent)
+	{
+		ofs << indent << "\"calls\": " << c.calls << ",\n"
+			<< indent << "\"wallTime\": " << c.wallTime << ",\n"
+			<< indent << "\"cpuTime\": " << c.cpuTime << ",\n"
+			<< indent << "\"bytesRead\": " << c.bytesRead << ",\n"
+			<< indent << "\"bytesWritten\": " << c.bytesWritten << ",\n"
+			<< indent << "\"filesCreated\": " << c.filesCreated << ",\n"
+			<< indent << "\"peakRSS\": " << c.peakRSS << ",\n"
+			<< indent << "\"textures\": {";
+
+		bool first = true;
+
+		for (auto &t : c.textures)
+		{
+			ofs << (first ? " " : ", ") << '"' << t.first << "\": " << t.second;
+			first = false;
+		}
+
+		ofs << (first ? "}" : " }");
+	};
+
+	ofs << "{\n\t\"total\": {\n";
+	writeCounters(stats.Total(), "\t\t");
+	ofs << "\n\t},\n\t\"stages\": {";
+
+	bool first = true;
+
+	for (auto &s : stats.stages)
+	{
+		ofs << (first ? "\n" : ",\n") << "\t\t\"" << s.first << "\": {\n";
+		writeCounters(s.second, "\t\t\t");
+		ofs << "\n\t\t}";
+		first = false;
+	}
+
+	ofs << "\n\t}\n}\n";
+
+	return !ofs.fail();
+}
@@ -0,0 +1,368 @@
+/*  XenoToolset tar stream output
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include "OutputSink.hpp"
+
+struct TarHeader
+{
+	char name[100],
+		mode[8],
+		uid[8],
+		gid[8],
+		size[12],
+		modifiedTime[12],
+		checksum[8],
+		type,
+		linkName[100],
+		magic[6],
+		version[2],
+		userName[32],
+		groupName[32],
+		deviceMajor[8],
+		deviceMinor[8],
+		prefix[155],
+		padding[12];
+};
+
+static_assert(sizeof(TarHeader) == 512, "Invalid TarHeader size.");
+
+// Streams entries as POSIX ustar archive in order of their keys.
+// Entry of current key is written straight away, later ones are buffered until their turn.
+// Memory of buffered entries is limited by bufferBudget, writers over it wait until their key comes.
+// This relies on tasks of reserved keys being started in order of keys, as ThreadPool does for tasks of one submitter.
+class TarSink : public OutputSink
+{
+public:
+	static const uint32_t blockSize = 512;
+	// Archive is padded to whole records like tar does, readers warn about shorter ones.
+	static const uint32_t recordSize = blockSize * 20;
+
+	TarSink(int fileHandle, const TSTRING &rootFolder, int64_t modifiedTime, size_t bufferBudget);
+	~TarSink() { Finish(); }
+
+	bool IsValid() const override { return stream.IsValid(); }
+	bool IsOrdered() const override { return true; }
+	size_t Reserve(size_t count) override;
+	void Complete(size_t key) override;
+
+	void CreateFolder(const TSTRING &path) override;
+	bool Write(const TSTRING &path, const std::vector<OutputPiece> &pieces) override;
+	bool Ingest(const TSTRING &path, const TSTRING &stagedFile) override;
+	bool Link(const TSTRING &targetPath, const TSTRING &path) override;
+	bool Finish() override;
+
+private:
+	enum EntryType
+	{
+		Entry_File = '0',
+		Entry_Link = '1',
+		Entry_Folder = '5',
+		Entry_Staged = 'S', // regular file, contents are taken from stagedFile once written
+	};
+
+	struct Entry
+	{
+		EntryType type;
+		std::string name,
+			linkName;
+		// vector keeps its storage when moved, pieces can point into it
+		std::vector<char> ownedData;
+		std::vector<OutputPiece> pieces;
+		TSTRING stagedFile;
+	};
+
+	struct Slot
+	{
+		std::vector<Entry> entries;
+		bool complete = false;
+	};
+
+	FileWriter stream;
+	TSTRING root;
+	int64_t mtime;
+	size_t budget,
+		bufferedBytes,
+		nextKey,
+		numKeys;
+	std::map<size_t, Slot> slots;
+	std::mutex sinkMutex;
+	std::condition_variable keyAdvanced;
+	bool failed;
+
+	bool Add(Entry &entry, size_t memorySize);
+	bool Emit(Entry &entry);
+	bool WriteHeader(const Entry &entry, uint64_t size);
+	bool Pad(uint64_t size);
+	void Advance();
+};
+
+inline TarSink::TarSink(int fileHandle, const TSTRING &rootFolder, int64_t modifiedTime, size_t bufferBudget) :
+	root(rootFolder), mtime(modifiedTime), budget(bufferBudget), bufferedBytes(0), nextKey(0), numKeys(0), failed(false)
+{
+	stream.Attach(fileHandle);
+}
+
+inline size_t TarSink::Reserve(size_t count)
+{
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	const size_t firstKey = numKeys;
+	numKeys += count;
+
+	return firstKey;
+}
+
+inline void TarSink::Complete(size_t key)
+{
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	slots[key].complete = true;
+	Advance();
+}
+
+// Emits buffered entries of keys that came to turn, must be called under lock.
+inline void TarSink::Advance()
+{
+	const size_t lastKey = nextKey;
+
+	for (auto it = slots.begin(); it != slots.end() && it->first == nextKey; it = slots.begin())
+	{
+		for (auto &e : it->second.entries)
+		{
+			bufferedBytes -= e.ownedData.size();
+
+			if (!Emit(e))
+				failed = true;
+		}
+
+		it->second.entries.clear();
+
+		if (!it->second.complete)
+			break;
+
+		slots.erase(it);
+		nextKey++;
+	}
+
+	if (lastKey != nextKey)
+		keyAdvanced.notify_all();
+}
+
+// Emits entry or buffers it until its key comes, key is taken from active OutputSlot or made for entry alone.
+inline bool TarSink::Add(Entry &entry, size_t memorySize)
+{
+	std::unique_lock<std::mutex> lock(sinkMutex);
+	size_t key;
+	const bool ownKey = !OutputSlot::GetKey(*this, key);
+
+	if (ownKey)
+		key = numKeys++;
+
+	if (memorySize)
+		keyAdvanced.wait(lock, [&]() { return key == nextKey || !bufferedBytes || bufferedBytes + memorySize <= budget; });
+
+	bool written = !failed;
+
+	if (key == nextKey)
+		written = written && Emit(entry);
+	else
+	{
+		// memory pieces are only valid during the call
+		entry.ownedData.reserve(memorySize);
+
+		for (auto &p : entry.pieces)
+			if (p.data)
+			{
+				const size_t dataOffset = entry.ownedData.size();
+				entry.ownedData.insert(entry.ownedData.end(), p.data, p.data + p.size);
+				p.data = entry.ownedData.data() + dataOffset;
+			}
+
+		bufferedBytes += entry.ownedData.size();
+		slots[key].entries.push_back(std::move(entry));
+	}
+
+	if (ownKey)
+	{
+		slots[key].complete = true;
+		Advance();
+	}
+
+	return written;
+}
+
+inline bool TarSink::WriteHeader(const Entry &entry, uint64_t size)
+{
+	TarHeader header = {};
+	const size_t nameSize = entry.name.size();
+	size_t nameBegin = 0;
+
+	// names over 100 chars are split at folder separator into prefix
+	if (nameSize > sizeof(header.name))
+	{
+		nameBegin = entry.name.find('/', nameSize - sizeof(header.name) - 1);
+
+		if (nameBegin == entry.name.npos || nameBegin > sizeof(header.prefix))
+			return false;
+
+		memcpy(header.prefix, entry.name.data(), nameBegin);
+		nameBegin++;
+	}
+
+	if (entry.linkName.size() > sizeof(header.linkName))
+		return false;
+
+	memcpy(header.name, entry.name.data() + nameBegin, nameSize - nameBegin);
+	memcpy(header.linkName, entry.linkName.data(), entry.linkName.size());
+	snprintf(header.mode, sizeof(header.mode), "%07o", entry.type == Entry_Folder ? 0755 : 0644);
+	snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+	snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+	snprintf(header.size, sizeof(header.size), "%011llo", static_cast<unsigned long long>(size));
+	snprintf(header.modifiedTime, sizeof(header.modifiedTime), "%011llo", static_cast<unsigned long long>(mtime));
+	header.type = static_cast<char>(entry.type == Entry_Staged ? Entry_File : entry.type);
+	memcpy(header.magic, "ustar", 6);
+	memcpy(header.version, "00", 2);
+	memset(header.checksum, ' ', sizeof(header.checksum));
+
+	unsigned int checksum = 0;
+
+	for (size_t c = 0; c < sizeof(header); c++)
+		checksum += reinterpret_cast<const unsigned char *>(&header)[c];
+
+	snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+	return stream.Write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+inline bool TarSink::Pad(uint64_t size)
+{
+	static const char zeros[blockSize] = {};
+
+	while (size)
+	{
+		const size_t chunk = size < blockSize ? static_cast<size_t>(size) : blockSize;
+
+		if (!stream.Write(zeros, chunk))
+			return false;
+
+		size -= chunk;
+	}
+
+	return true;
+}
+
+inline bool TarSink::Emit(Entry &entry)
+{
+	if (entry.type == Entry_Staged)
+	{
+		bool written = false;
+
+		{
+			MappedFile staged(entry.stagedFile);
+
+			if (staged.IsValid())
+				written = WriteHeader(entry, staged.GetSize()) && stream.WriteRange(staged, 0, staged.GetSize()) &&
+					Pad((blockSize - staged.GetSize() % blockSize) % blockSize);
+		}
+
+		RemoveFile(entry.stagedFile);
+
+		return written;
+	}
+
+	uint64_t size = 0;
+
+	for (auto &p : entry.pieces)
+		size += p.size;
+
+	if (!WriteHeader(entry, size))
+		return false;
+
+	for (auto &p : entry.pieces)
+		if (!(p.data ? stream.Write(p.data, p.size) : p.source ? stream.WriteRange(*p.source, p.offset, p.size) : Pad(p.size)))
+			return false;
+
+	return Pad((blockSize - size % blockSize) % blockSize);
+}
+
+inline void TarSink::CreateFolder(const TSTRING &path)
+{
+	Entry entry = {};
+	entry.type = Entry_Folder;
+	entry.name = MakeEntryName(root, path);
+
+	if (entry.name.empty() || entry.name.back() != '/')
+		entry.name.push_back('/');
+
+	Add(entry, 0);
+}
+
+inline bool TarSink::Write(const TSTRING &path, const std::vector<OutputPiece> &pieces)
+{
+	Entry entry = {};
+	entry.type = Entry_File;
+	entry.name = MakeEntryName(root, path);
+	entry.pieces = pieces;
+
+	size_t memorySize = 0;
+
+	for (auto &p : pieces)
+		if (p.data)
+			memorySize += p.size;
+
+	return Add(entry, memorySize);
+}
+
+inline bool TarSink::Ingest(const TSTRING &path, const TSTRING &stagedFile)
+{
+	Entry entry = {};
+	entry.type = Entry_Staged;
+	entry.name = MakeEntryName(root, path);
+	entry.stagedFile = stagedFile;
+
+	return Add(entry, 0);
+}
+
+inline bool TarSink::Link(const TSTRING &targetPath, const TSTRING &path)
+{
+	Entry entry = {};
+	entry.type = Entry_Link;
+	entry.name = MakeEntryName(root, path);
+	entry.linkName = MakeEntryName(root, targetPath);
+
+	return Add(entry, 0);
+}
+
+inline bool TarSink::Finish()
+{
+	std::lock_guard<std::mutex> lock(sinkMutex);
+
+	if (!stream.IsValid())
+		return !failed;
+
+	// every reserved key should be completed by now
+	if (!slots.empty() || nextKey != numKeys)
+		failed = true;
+
+	failed = !Pad(blockSize * 2) || failed;
+	failed = !Pad((recordSize - stream.Tell() % recordSize) % recordSize) || failed;
+	stream.Close();
+
+	return !failed;
+}
@@ -0,0 +1,370 @@
+/*  XenoToolset thread pool
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool, every worker has its own queue, tasks submitted by worker go into it.
+// Tasks submitted from outside of pool go into shared queue. Idle workers take tasks from other queues.
+// Tasks submitted by one thread are started in order of their submission, ordered sinks rely on it.
+// Outer tasks (e.g. stages, which wait for tasks of their own) are kept in separate queue,
+// they're started only by threads that aren't waiting within another task,
+// so a wait helps with short tasks, but never runs whole unrelated stage and nesting stays bounded.
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	ThreadPool(int numThreads = 0);
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+	~ThreadPool();
+
+	// Process-wide pool, workers are started on first use.
+	static ThreadPool &Global();
+
+	void Submit(Task task, bool outer = false);
+	int NumWorkers() const { return static_cast<int>(workers.size()); }
+
+	// Runs queued tasks on calling thread until isDone returns true.
+	// Every state change isDone depends on must be followed by Notify.
+	// isDone is called once per wake-up, but may be called any number of times, it must not have side effects.
+	template<class Pred> void HelpUntil(Pred isDone);
+	void Notify();
+
+private:
+	struct TaskQueue
+	{
+		std::deque<Task> tasks;
+		std::mutex queueMutex;
+	};
+
+	struct WorkerInfo
+	{
+		ThreadPool *pool;
+		int index;
+	};
+
+	std::vector<std::thread> workers;
+	// last one is shared queue
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	TaskQueue outerTasks;
+	std::atomic<size_t> numQueued,
+		numOuterQueued;
+	// bumped by every Notify, sleeping helpers recheck their predicates then
+	std::atomic<size_t> generation;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<bool> stopping;
+
+	static WorkerInfo &CurrentWorker()
+	{
+		static thread_local WorkerInfo current = { nullptr, 0 };
+		return current;
+	}
+
+	// Number of HelpUntil calls active on calling thread, outer tasks are started only by the first one.
+	static int &HelpDepth()
+	{
+		static thread_local int depth = 0;
+		return depth;
+	}
+
+	int GetQueueIndex();
+	bool TryPop(Task &task, bool allowOuter);
+	void WorkerLoop(int index);
+};
+
+// Tracks a set of tasks submitted into ThreadPool.
+// Wait helps executing queued tasks, so it can be safely called from within a pool task.
+class TaskGroup
+{
+	ThreadPool &pool;
+	std::atomic<int> pending;
+public:
+	TaskGroup(ThreadPool &inPool) : pool(inPool), pending(0) {}
+	TaskGroup(const TaskGroup &) = delete;
+	TaskGroup &operator=(const TaskGroup &) = delete;
+	~TaskGroup() { Wait(); }
+
+	// Outer task is run only by thread that isn't waiting within another task, see ThreadPool.
+	void Run(ThreadPool::Task task, bool outer = false);
+	void Wait();
+	bool IsDone() const { return !pending; }
+};
+
+// Set of tasks with dependencies, a task is queued once all of its dependencies are done.
+// Tasks are queued as outer tasks, they're expected to be long and wait for tasks of their own.
+class TaskGraph
+{
+public:
+	typedef int NodeID;
+
+	NodeID Add(ThreadPool::Task task, std::initializer_list<NodeID> dependencies = {});
+	void Run(ThreadPool &pool);
+
+private:
+	struct Node
+	{
+		ThreadPool::Task task;
+		std::vector<NodeID> dependents;
+		int numDependencies;
+		std::atomic<int> remaining;
+	};
+
+	std::vector<std::unique_ptr<Node>> nodes;
+
+	void Schedule(TaskGroup &group, NodeID id);
+};
+
+template<class Func> void ParallelFor(ThreadPool &pool, int count, Func func)
+{
+	TaskGroup group(pool);
+
+	for (int i = 0; i < count; i++)
+		group.Run([&func, i]() { func(i); });
+
+	group.Wait();
+}
+
+// Queues all items of RunThreadedQueue style traits into group, every item gets its own copy of traits.
+template<class Traits> void SubmitQueue(TaskGroup &group, Traits &traits)
+{
+	while (traits)
+	{
+		Traits item = traits;
+		group.Run([item]() mutable { item.RetreiveItem(); });
+		traits++;
+	}
+}
+
+// Pool counterpart of RunThreadedQueue.
+template<class Traits> void RunPooledQueue(ThreadPool &pool, Traits &traits)
+{
+	TaskGroup group(pool);
+	SubmitQueue(group, traits);
+	group.Wait();
+}
+
+inline ThreadPool::ThreadPool(int numThreads) : numQueued(0), numOuterQueued(0), generation(0), stopping(false)
+{
+	if (numThreads < 1)
+		numThreads = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	for (int q = 0; q <= numThreads; q++)
+		queues.emplace_back(new TaskQueue);
+
+	for (int t = 0; t < numThreads; t++)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, t);
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	stopping = true;
+	Notify();
+
+	for (auto &w : workers)
+		w.join();
+}
+
+inline ThreadPool &ThreadPool::Global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+inline int ThreadPool::GetQueueIndex()
+{
+	const WorkerInfo &worker = CurrentWorker();
+
+	return worker.pool == this ? worker.index : NumWorkers();
+}
+
+inline void ThreadPool::Submit(Task task, bool outer)
+{
+	TaskQueue &queue = outer ? outerTasks : *queues[GetQueueIndex()];
+
+	// counted ahead, so it never drops below number of queued tasks
+	(outer ? numOuterQueued : numQueued)++;
+
+	{
+		std::lock_guard<std::mutex> lock(queue.queueMutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	Notify();
+}
+
+inline void ThreadPool::Notify()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		generation++;
+	}
+
+	wake.notify_all();
+}
+
+// Own queue goes first, then shared queue, queues of other workers and outer tasks last.
+// Every queue is taken from front, so tasks of one submitter start in order.
+inline bool ThreadPool::TryPop(Task &task, bool allowOuter)
+{
+	if (numQueued)
+	{
+		const int numQueues = static_cast<int>(queues.size());
+		const int first = GetQueueIndex();
+
+		for (int q = 0; q < numQueues; q++)
+		{
+			TaskQueue &queue = *queues[(first + q) % numQueues];
+			std::lock_guard<std::mutex> lock(queue.queueMutex);
+
+			if (queue.tasks.empty())
+				continue;
+
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			numQueued--;
+
+			return true;
+		}
+	}
+
+	if (!allowOuter || !numOuterQueued)
+		return false;
+
+	std::lock_guard<std::mutex> lock(outerTasks.queueMutex);
+
+	if (outerTasks.tasks.empty())
+		return false;
+
+	task = std::move(outerTasks.tasks.front());
+	outerTasks.tasks.pop_front();
+	numOuterQueued--;
+
+	return true;
+}
+
+template<class Pred> void ThreadPool::HelpUntil(Pred isDone)
+{
+	struct DepthGuard
+	{
+		DepthGuard() { HelpDepth()++; }
+		~DepthGuard() { HelpDepth()--; }
+	} depthGuard;
+
+	const bool allowOuter = HelpDepth() == 1;
+
+	while (true)
+	{
+		// taken before isDone, so Notify after it cannot be missed
+		const size_t seenGeneration = generation;
+
+		if (isDone())
+			return;
+
+		Task task;
+
+		if (TryPop(task, allowOuter))
+		{
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [&]() { return numQueued || (allowOuter && numOuterQueued) || generation != seenGeneration; });
+	}
+}
+
+inline void ThreadPool::WorkerLoop(int index)
+{
+	CurrentWorker() = { this, index };
+	HelpUntil([this]() { return stopping && !numQueued && !numOuterQueued; });
+}
+
+inline void TaskGroup::Run(ThreadPool::Task task, bool outer)
+{
+	pending++;
+
+	// group may be gone right after pending drops to zero, pool must be captured on its own
+	ThreadPool *ownerPool = &pool;
+
+	pool.Submit([this, ownerPool, task]()
+	{
+		task();
+
+		if (!--pending)
+			ownerPool->Notify();
+	}, outer);
+}
+
+inline void TaskGroup::Wait()
+{
+	pool.HelpUntil([this]() { return !pending; });
+}
+
+inline TaskGraph::NodeID TaskGraph::Add(ThreadPool::Task task, std::initializer_list<NodeID> dependencies)
+{
+	const NodeID id = static_cast<NodeID>(nodes.size());
+	nodes.emplace_back(new Node);
+	Node &node = *nodes.back();
+	node.task = std::move(task);
+	node.numDependencies = static_cast<int>(dependencies.size());
+
+	for (NodeID d : dependencies)
+		nodes[d]->dependents.push_back(id);
+
+	return id;
+}
+
+inline void TaskGraph::Run(ThreadPool &pool)
+{
+	TaskGroup group(pool);
+
+	for (auto &n : nodes)
+		n->remaining = n->numDependencies;
+
+	for (NodeID n = 0; n < static_cast<NodeID>(nodes.size()); n++)
+		if (!nodes[n]->numDependencies)
+			Schedule(group, n);
+
+	group.Wait();
+}
+
+inline void TaskGraph::Schedule(TaskGroup &group, NodeID id)
+{
+	group.Run([this, &group, id]()
+	{
+		Node &node = *nodes[id];
+		node.task();
+
+		for (NodeID d : node.dependents)
+			if (!--nodes[d]->remaining)
+				Schedule(group, d);
+	}, true);
+}
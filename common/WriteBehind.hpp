@@ -0,0 +1,127 @@
+/*  XenoToolset write-behind writer
+	Copyright(C) 2019 Lukas Cone
+
+	This program is free software : you can redistribute it and / or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Stats.hpp"
+
+// Dedicated threads doing output I/O handed over by compute threads.
+// Queue is bounded by size of handed over data, Submit blocks while it's full.
+class WriteBehind
+{
+public:
+	typedef std::function<void()> Job;
+
+	// Every queued job counts at least this much, so queue of small jobs is bounded too.
+	static const size_t jobOverhead = 0x1000;
+
+	WriteBehind(int numThreads, size_t maxQueuedSize);
+	WriteBehind(const WriteBehind &) = delete;
+	WriteBehind &operator=(const WriteBehind &) = delete;
+	~WriteBehind();
+
+	void Submit(Job job, size_t size);
+
+private:
+	struct QueuedJob
+	{
+		Job job;
+		size_t size;
+	};
+
+	std::vector<std::thread> writers;
+	std::deque<QueuedJob> jobs;
+	std::mutex queueMutex;
+	std::condition_variable jobQueued;
+	std::condition_variable jobDone;
+	size_t queuedSize,
+		maxSize;
+	bool stopping;
+
+	void WriterLoop();
+};
+
+inline WriteBehind::WriteBehind(int numThreads, size_t maxQueuedSize) : queuedSize(0), maxSize(maxQueuedSize), stopping(false)
+{
+	if (numThreads < 1)
+		numThreads = 1;
+
+	for (int t = 0; t < numThreads; t++)
+		writers.emplace_back(&WriteBehind::WriterLoop, this);
+}
+
+inline WriteBehind::~WriteBehind()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+
+	jobQueued.notify_all();
+
+	for (auto &w : writers)
+		w.join();
+}
+
+inline void WriteBehind::Submit(Job job, size_t size)
+{
+	size += jobOverhead;
+
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+
+		// job bigger than whole queue gets in alone
+		jobDone.wait(lock, [&]() { return !queuedSize || queuedSize + size <= maxSize; });
+
+		queuedSize += size;
+		jobs.push_back({ std::move(job), size });
+	}
+
+	jobQueued.notify_one();
+}
+
+inline void WriteBehind::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+
+	while (true)
+	{
+		jobQueued.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+		if (jobs.empty())
+			return;
+
+		QueuedJob item = std::move(jobs.front());
+		jobs.pop_front();
+		lock.unlock();
+
+		{
+			Stats::Scope scope("WriteBehind");
+			item.job();
+		}
+
+		lock.lock();
+
+		queuedSize -= item.size;
+		jobDone.notify_all();
+	}
+}
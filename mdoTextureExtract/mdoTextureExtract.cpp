@@ -15,13 +15,22 @@
 	along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include "MXMD.h"
 #include "DRSM.h"
 #include "datas/SettingsManager.hpp"
 #include "datas/fileinfo.hpp"
-#include "datas/MultiThread.hpp"
 #include "pugixml.hpp"
+#include "../common/FileIO.hpp"
+#include "../common/InputFiles.hpp"
+#include "../common/OutputState.hpp"
+#include "../common/Stats.hpp"
+#include "../common/ThreadPool.hpp"
 
 #ifndef _MSC_VER
 #define _tmain main
@@ -37,27 +46,144 @@ static struct mdoTex : SettingsManager
 	bool Generate_Log = false;
 	bool PNG_Output = false;
 	bool BC5_Generate_Blue = true;
+	bool Generate_Stats = false;
 }settings;
 
-REFLECTOR_START_WNAMES(mdoTex, PNG_Output, BC5_Generate_Blue, Generate_Log);
+REFLECTOR_START_WNAMES(mdoTex, PNG_Output, BC5_Generate_Blue, Generate_Log, Generate_Stats);
 
 static const char help[] = "\nExtracts textures from camdo/wimdo/wismt(DRSM) files.\n\
+Files and their textures are extracted on shared threads.\n\
+Arguments are files, folders searched recursively for MXMD/DRSM files,\n\
+@file with list of paths, one per line, or - for such list from standard input.\n\
 Settings (.config file):\n\
   PNG_Output: \n\
         Exported textures will be converted into PNG format, rather than DDS.\n\
   BC5_Generate_Blue:\n\
         Will generate blue channel for some formats used for normal maps.\n\
   Generate_Log: \n\
-        Will generate text log of console output next to application location.\n\t";
+        Will generate text log of console output next to application location.\n\
+  Generate_Stats: \n\
+        Will print run statistics and write them into json file next to application location.\n\t";
 
 static const char pressKeyCont[] = "\nPress ENTER to close.";
 
+// Files loaded at once, textures of loaded files are extracted while next ones are loading.
+static std::atomic<int> filesInFlight(0);
+// Files sharing texture folder, e.g. .wimdo and .wismt of the same model, are extracted one after another.
+// Every folder being extracted into has queue of files waiting for it.
+static std::map<TSTRING, std::deque<TSTRING>> texFolderQueues;
+static std::mutex texFolderMutex;
+
+void ProcessFile(TaskGroup &group, const TSTRING &fileName);
+
+TSTRING GetTexFolder(const TSTRING &fileName)
+{
+	TFileInfo texInfo(fileName);
+	return texInfo.GetPath() + texInfo.GetFileName() + _T("/");
+}
+
+void SubmitFile(TaskGroup &group, const TSTRING &fileName)
+{
+	{
+		std::lock_guard<std::mutex> lock(texFolderMutex);
+		auto inserted = texFolderQueues.emplace(GetTexFolder(fileName), std::deque<TSTRING>());
+
+		if (!inserted.second)
+		{
+			inserted.first->second.push_back(fileName);
+			return;
+		}
+	}
+
+	group.Run([&group, fileName]() { ProcessFile(group, fileName); });
+}
+
+struct ExtractedFile
+{
+	TaskGroup *group;
+	TSTRING texFolder;
+	DRSM streamFile;
+	std::atomic<int> remainingTextures;
+	// textures found in texture folder before extraction, for stats only
+	std::map<TSTRING, FileStamp> previousTextures;
+};
+
+ES_FORCEINLINE const TCHAR *GetTextureExtension()
+{
+	return settings.PNG_Output ? _T(".png") : _T(".dds");
+}
+
+// XenoLib doesn't report what it wrote, so textures are counted by files in folder they were extracted into,
+// that weren't there or changed since extraction started.
+void CountExtractedTextures(const ExtractedFile &file, const char *container)
+{
+	if (!Stats::IsEnabled())
+		return;
+
+	for (auto &f : ListFiles(file.texFolder, GetTextureExtension()))
+	{
+		FileStamp stamp;
+		auto found = file.previousTextures.find(f);
+
+		if (found != file.previousTextures.end() && GetFileStamp(f, stamp) && stamp == found->second)
+			continue;
+
+		Stats::AddOutputFile(f);
+		Stats::AddTexture(container, settings.PNG_Output ? "png" : "dds");
+	}
+}
+
+// Next file waiting for the same texture folder takes its place.
+void ReleaseFile(const ExtractedFile &file)
+{
+	TSTRING nextFile;
+
+	{
+		std::lock_guard<std::mutex> lock(texFolderMutex);
+		auto found = texFolderQueues.find(file.texFolder);
+
+		if (found->second.empty())
+			texFolderQueues.erase(found);
+		else
+		{
+			nextFile = found->second.front();
+			found->second.pop_front();
+		}
+	}
+
+	if (!nextFile.empty())
+	{
+		TaskGroup &group = *file.group;
+		group.Run([&group, nextFile]() { ProcessFile(group, nextFile); });
+	}
+
+	filesInFlight--;
+	ThreadPool::Global().Notify();
+}
+
+void FinishFile(const ExtractedFile &file, const char *container)
+{
+	CountExtractedTextures(file, container);
+	ReleaseFile(file);
+}
+
+void CreateTexFolder(ExtractedFile &file)
+{
+	_tmkdir(file.texFolder.c_str());
+
+	if (!Stats::IsEnabled())
+		return;
+
+	for (auto &f : ListFiles(file.texFolder, GetTextureExtension()))
+		GetFileStamp(f, file.previousTextures[f]);
+}
+
+// Last extracted texture finishes its file.
 struct TextureQueue
 {
 	int queue;
 	int queueEnd;
-	const DRSM *caller;
-	const TCHAR *folderPath;
+	std::shared_ptr<ExtractedFile> file;
 
 	typedef int return_type;
 
@@ -65,7 +191,16 @@ struct TextureQueue
 
 	return_type RetreiveItem()
 	{
-		int result = caller->ExtractTexture(folderPath, queue, { settings.PNG_Output, settings.BC5_Generate_Blue });
+		int result;
+
+		{
+			Stats::Scope scope("ExtractTexture");
+			result = file->streamFile.ExtractTexture(file->texFolder.c_str(), queue, { settings.PNG_Output, settings.BC5_Generate_Blue });
+		}
+
+		if (!--file->remainingTextures)
+			FinishFile(*file, "DRSM");
+
 		return result;
 	}
 
@@ -74,6 +209,79 @@ struct TextureQueue
 	int NumQueues() const { return queueEnd; }
 };
 
+// Files found in folders are recognized by magic, either byte order is accepted.
+bool IsModelFile(const TSTRING &filePath)
+{
+	int magic;
+
+	if (!ReadFileMagic(filePath, magic))
+		return false;
+
+	for (int m : { CompileFourCC("DMXM"), CompileFourCC("MXMD"), CompileFourCC("DRSM"), CompileFourCC("MSRD") })
+		if (magic == m)
+			return true;
+
+	return false;
+}
+
+// Every file is a task, DRSM textures are queued into the same group as tasks of their own.
+void ProcessFile(TaskGroup &group, const TSTRING &fileName)
+{
+	Stats::Scope scope("ProcessFile");
+	Stats::AddInputFile(fileName);
+	printline("Processing file: ", << fileName);
+
+	std::shared_ptr<ExtractedFile> file = std::make_shared<ExtractedFile>();
+	file->group = &group;
+	file->texFolder = GetTexFolder(fileName);
+
+	MXMD modFile;
+
+	if (!modFile.Load(fileName.c_str()))
+	{
+		printline("MXMD detected.");
+
+		MXMDTextures::Ptr textures = modFile.GetTextures();
+
+		if (!textures)
+		{
+			ReleaseFile(*file);
+			return;
+		}
+
+		CreateTexFolder(*file);
+
+		{
+			Stats::Scope scope("ExtractAllTextures");
+			textures->ExtractAllTextures(file->texFolder.c_str(), { settings.PNG_Output, settings.BC5_Generate_Blue });
+		}
+
+		FinishFile(*file, "MXMD");
+		return;
+	}
+
+	if (!file->streamFile.Load(fileName.c_str()))
+	{
+		printline("DRSM detected.");
+
+		CreateTexFolder(*file);
+
+		TextureQueue texQue;
+		texQue.file = file;
+		texQue.queueEnd = file->streamFile.GetNumTextures();
+		file->remainingTextures = texQue.queueEnd;
+
+		if (!texQue.queueEnd)
+			FinishFile(*file, "DRSM");
+		else
+			SubmitQueue(group, texQue);
+
+		return;
+	}
+
+	ReleaseFile(*file);
+}
+
 int _tmain(int argc, _TCHAR *argv[])
 {
 	setlocale(LC_ALL, "");
@@ -115,46 +323,35 @@ int _tmain(int argc, _TCHAR *argv[])
 	if (settings.Generate_Log)
 		settings.CreateLog(configInfo.GetPath() + configInfo.GetFileName());
 
-	for (int f = 1; f < argc; f++)
-	{
-		printline("Processing file: ", << argv[f]);
-
-		TFileInfo texInfo(argv[f]);
-		TSTRING texFolder = texInfo.GetPath() + texInfo.GetFileName() + _T("/");
-		MXMD modFile;
-
-		if (!modFile.Load(argv[f]))
-		{
-			printline("MXMD detected.");
+	if (settings.Generate_Stats)
+		Stats::Enable();
 
-			MXMDTextures::Ptr textures = modFile.GetTextures();
+	ThreadPool &pool = ThreadPool::Global();
+	const int maxFilesInFlight = pool.NumWorkers() * 2;
+	InputFiles inputs(pool, IsModelFile);
+	TaskGroup group(pool);
+	TSTRING fileName;
 
-			if (!textures)
-				continue;
+	for (int a = 1; a < argc; a++)
+		inputs.Add(argv[a]);
 
-			_tmkdir(texFolder.c_str());
-
-			textures->ExtractAllTextures(texFolder.c_str(), { settings.PNG_Output, settings.BC5_Generate_Blue });
-			continue;
-		}
-
-		DRSM streamFile;
-
-		if (!streamFile.Load(argv[f]))
-		{
-			printline("DRSM detected.");
+	while (inputs.Next(fileName))
+	{
+		pool.HelpUntil([maxFilesInFlight]() { return filesInFlight < maxFilesInFlight; });
+		filesInFlight++;
 
-			_tmkdir(texFolder.c_str());
+		SubmitFile(group, fileName);
+	}
 
-			TextureQueue texQue;
-			texQue.caller = &streamFile;
-			texQue.queueEnd = streamFile.GetNumTextures();
-			texQue.folderPath = texFolder.c_str();
+	group.Wait();
 
-			RunThreadedQueue(texQue);
-			continue;
-		}
+	if (settings.Generate_Stats)
+	{
+		const TSTRING statsFile = configInfo.GetPath() + configInfo.GetFileName() + _T("_stats.json");
+		printline(esStringConvert<TCHAR>(Stats::Report().c_str()));
 
+		if (!Stats::SaveJSON(statsFile))
+			printerror("Couldn't write file: ", << statsFile);
 	}
 
 
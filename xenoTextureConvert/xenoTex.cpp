@@ -16,12 +16,15 @@
 */
 
 #include <thread>
+#include <vector>
 #include "XenoLibAPI.h"
 #include "datas/SettingsManager.hpp"
 #include "datas/fileinfo.hpp"
-#include "datas/MultiThread.hpp"
-#include "datas/binreader.hpp"
 #include "pugixml.hpp"
+#include "../common/FileIO.hpp"
+#include "../common/InputFiles.hpp"
+#include "../common/Stats.hpp"
+#include "../common/ThreadPool.hpp"
 
 #ifndef _MSC_VER
 #define _tmain main
@@ -35,42 +38,51 @@ static struct xenoTex : SettingsManager
 	bool Generate_Log = false;
 	bool PNG_Output = false;
 	bool BC5_Generate_Blue = true;
+	bool Generate_Stats = false;
 }settings;
 
-REFLECTOR_START_WNAMES(xenoTex, PNG_Output, BC5_Generate_Blue, Generate_Log);
+REFLECTOR_START_WNAMES(xenoTex, PNG_Output, BC5_Generate_Blue, Generate_Log, Generate_Stats);
 
 static const char help[] = "\nConverts MTXT/LBIM into DDS/PNG formats.\n\
+Arguments are files, folders searched recursively for MTXT/LBIM files,\n\
+@file with list of paths, one per line, or - for such list from standard input.\n\
 Settings (.config file):\n\
   PNG_Output: \n\
         Exported textures will be converted into PNG format, rather than DDS.\n\
   BC5_Generate_Blue:\n\
         Will generate blue channel for some formats used for normal maps.\n\
   Generate_Log: \n\
-        Will generate text log of console output next to application location.\n\t";
+        Will generate text log of console output next to application location.\n\
+  Generate_Stats: \n\
+        Will print run statistics and write them into json file next to application location.\n\t";
 
 static const char pressKeyCont[] = "\nPress ENTER to close.";
 
-struct TexQueueTraits
+// XenoLib writes converted texture on its own, it's counted by file name it was asked for.
+template<class Func> void ConvertTexture(const char *container, const TSTRING &outName, Func convert)
 {
-	int queue;
-	int queueEnd;
-	TCHAR **files;
-	typedef void return_type;
+	Stats::AddTexture(container, settings.PNG_Output ? "png" : "dds");
+	convert(outName.c_str());
+	Stats::AddOutputFile(outName + (settings.PNG_Output ? _T(".png") : _T(".dds")));
+}
 
-	return_type RetreiveItem();
+// Files found in folders are recognized by magic at their end.
+bool IsTextureFile(const TSTRING &filePath)
+{
+	int magic;
 
-	operator bool() { return queue < queueEnd; }
-	void operator++(int) { queue++; }
-	int NumQueues() const { return queueEnd - 1; }
-};
+	return ReadFileMagic(filePath, magic, true) && (magic == CompileFourCC("MTXT") || magic == CompileFourCC("LBIM"));
+}
 
-TexQueueTraits::return_type TexQueueTraits::RetreiveItem()
+// Input is mapped copy-on-write, XenoLib may modify buffer in place, but file stays intact.
+// Files that cannot be mapped are read into buffer reused by next files of the same thread.
+void ConvertFile(const TSTRING &curFile)
 {
-	const TCHAR *curFile = files[queue];
+	Stats::Scope scope("ConvertFile");
 	TFileInfo fleInfo(curFile);
-	BinReader rd(curFile);
+	MappedFile input(curFile, true);
 
-	if (!rd.IsValid())
+	if (!input.IsValid())
 	{
 		printerror("Couldn't load file: ", << curFile);
 		return;
@@ -78,12 +90,34 @@ TexQueueTraits::return_type TexQueueTraits::RetreiveItem()
 
 	printline("Loading file: ", << curFile);
 
-	rd.Seek(-4, std::ios_base::seekdir::_S_cur);
+	const int fileSize = static_cast<int>(input.GetSize());
+
+	if (fileSize < 4)
+	{
+		printerror("Invalid file format.");
+		return;
+	}
+
+	char *buffer = input.GetPrivateData();
+
+	if (buffer)
+		Stats::AddRead(fileSize);
+	else
+	{
+		static thread_local std::vector<char> readBuffer;
+		readBuffer.resize(fileSize);
+
+		if (!input.ReadAt(readBuffer.data(), 0, fileSize))
+		{
+			printerror("Couldn't load file: ", << curFile);
+			return;
+		}
+
+		buffer = readBuffer.data();
+	}
 
 	int magic;
-	const int fileSize = static_cast<int>(rd.GetSize());
-	rd.Read(magic);
-	rd.Seek(0);
+	memcpy(&magic, buffer + fileSize - 4, sizeof(magic));
 
 	switch (magic)
 	{
@@ -91,10 +125,10 @@ TexQueueTraits::return_type TexQueueTraits::RetreiveItem()
 	{
 		printline("MTXT detected.");
 
-		char *buffer = static_cast<char *>(malloc(fileSize));
-		rd.ReadBuffer(buffer, fileSize);
-
-		ConvertMTXT(buffer, fileSize, (fleInfo.GetPath() + fleInfo.GetFileName()).c_str(), { settings.PNG_Output, settings.BC5_Generate_Blue });
+		ConvertTexture("MTXT", fleInfo.GetPath() + fleInfo.GetFileName(), [&](const TCHAR *outName)
+		{
+			ConvertMTXT(buffer, fileSize, outName, { settings.PNG_Output, settings.BC5_Generate_Blue });
+		});
 		break;
 	}
 
@@ -102,10 +136,10 @@ TexQueueTraits::return_type TexQueueTraits::RetreiveItem()
 	{
 		printline("LBIM detected.");
 
-		char *buffer = static_cast<char *>(malloc(fileSize));
-		rd.ReadBuffer(buffer, fileSize);
-
-		ConvertLBIM(buffer, fileSize, (fleInfo.GetPath() + fleInfo.GetFileName()).c_str(), { settings.PNG_Output, settings.BC5_Generate_Blue });
+		ConvertTexture("LBIM", fleInfo.GetPath() + fleInfo.GetFileName(), [&](const TCHAR *outName)
+		{
+			ConvertLBIM(buffer, fileSize, outName, { settings.PNG_Output, settings.BC5_Generate_Blue });
+		});
 		break;
 	}
 	default:
@@ -158,12 +192,30 @@ int _tmain(int argc, _TCHAR *argv[])
 
 	printer.PrintThreadID(true);
 
-	TexQueueTraits texQue;
-	texQue.files = argv;
-	texQue.queue = 1;
-	texQue.queueEnd = argc;
+	if (settings.Generate_Stats)
+		Stats::Enable();
+
+	ThreadPool &pool = ThreadPool::Global();
+	InputFiles inputs(pool, IsTextureFile);
+	TaskGroup group(pool);
+	TSTRING fileName;
 
-	RunThreadedQueue(texQue);
+	for (int a = 1; a < argc; a++)
+		inputs.Add(argv[a]);
+
+	while (inputs.Next(fileName))
+		group.Run([fileName]() { ConvertFile(fileName); });
+
+	group.Wait();
+
+	if (settings.Generate_Stats)
+	{
+		const TSTRING statsFile = configInfo.GetPath() + configInfo.GetFileName() + _T("_stats.json");
+		printline(esStringConvert<TCHAR>(Stats::Report().c_str()));
+
+		if (!Stats::SaveJSON(statsFile))
+			printerror("Couldn't write file: ", << statsFile);
+	}
 
 	return 0;
 }
\ No newline at end of file